@@ -0,0 +1,420 @@
+// Benchmarks of VirusGenealogy operations on synthetic genealogies.
+//
+// Build from the repository root and run with
+//     g++ -O2 -std=c++20 -I. benchmark/virus_genealogy_benchmark.cc -o bench
+//     ./bench [nodes] [filter]
+// Only cases whose "policy/shape/operation" name contains the filter
+// are run. Every case reports the number of timed calls, throughput in
+// processed items (created nodes, removed nodes, visited children...) per
+// second, latency percentiles of single calls and peak memory allocated
+// by the genealogy from its memory resource. Memory allocated by ids
+// themselves, e.g. long std::strings, is not included.
+#include "virus_genealogy.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory_resource>
+#include <random>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <sys/resource.h>
+
+namespace {
+    template<class Id>
+    class BasicVirus {
+    public:
+        using id_type = Id;
+
+        BasicVirus(id_type const &_id) : id(_id) {
+        }
+
+        id_type const &get_id() const {
+            return id;
+        }
+
+    private:
+        id_type id;
+    };
+
+    using StringVirus = BasicVirus<std::string>;
+    using IntVirus = BasicVirus<std::uint64_t>;
+
+    template<class Id>
+    Id make_id(std::size_t i) {
+        if constexpr (std::is_integral_v<Id>)
+            return Id(i);
+        else
+            return "V" + std::to_string(i);
+    }
+
+    // Tracks bytes allocated through it, so every case can report the peak.
+    class counting_resource : public std::pmr::memory_resource {
+    private:
+        std::size_t current = 0;
+        std::size_t highest = 0;
+
+        void *do_allocate(std::size_t bytes, std::size_t align) override {
+            void *p = std::pmr::new_delete_resource()->allocate(bytes, align);
+            current += bytes;
+            highest = std::max(highest, current);
+            return p;
+        }
+
+        void do_deallocate(void *p, std::size_t bytes,
+                           std::size_t align) override {
+            std::pmr::new_delete_resource()->deallocate(p, bytes, align);
+            current -= bytes;
+        }
+
+        bool do_is_equal(
+                std::pmr::memory_resource const &other) const noexcept override {
+            return this == &other;
+        }
+
+    public:
+        std::size_t peak() const noexcept {
+            return highest;
+        }
+    };
+
+    // Node i > 0 of a shape has parents[i], all of them smaller than i.
+    // Node 0 is the stem.
+    struct shape {
+        std::string name;
+        std::vector<std::vector<std::size_t>> parents;
+
+        std::size_t size() const noexcept {
+            return parents.size();
+        }
+    };
+
+    shape deep_chain(std::size_t n) {
+        shape s{"chain", std::vector<std::vector<std::size_t>>(n)};
+        for (std::size_t i = 1; i < n; i++)
+            s.parents[i] = {i - 1};
+        return s;
+    }
+
+    shape wide_fan_out(std::size_t n) {
+        shape s{"fan-out", std::vector<std::vector<std::size_t>>(n)};
+        for (std::size_t i = 1; i < n; i++)
+            s.parents[i] = {0};
+        return s;
+    }
+
+    // Every node has up to four distinct parents chosen among earlier ones.
+    shape dense_dag(std::size_t n, std::mt19937_64 &rng) {
+        shape s{"dag", std::vector<std::vector<std::size_t>>(n)};
+        for (std::size_t i = 1; i < n; i++) {
+            auto &parents = s.parents[i];
+            std::uniform_int_distribution<std::size_t> pick(0, i - 1);
+            for (std::size_t k = std::min<std::size_t>(i, 4); parents.size() < k;) {
+                auto p = pick(rng);
+                if (std::find(parents.begin(), parents.end(), p) == parents.end())
+                    parents.push_back(p);
+            }
+        }
+        return s;
+    }
+
+    struct result {
+        std::vector<std::uint64_t> samples;
+        std::size_t items = 0;
+        std::chrono::nanoseconds total{0};
+        std::size_t peak = 0;
+    };
+
+    // Keeps the compiler from dropping computation of a value.
+    template<class T>
+    void keep(T const &value) {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    // Times a single call and records its latency.
+    template<class F>
+    void timed(result &r, F &&f) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        r.samples.push_back(std::uint64_t(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        elapsed).count()));
+        r.total += elapsed;
+    }
+
+    void report(std::string_view name, result &r) {
+        auto &s = r.samples;
+        std::sort(s.begin(), s.end());
+        auto at = [&](double q) {
+            return s.empty() ? 0 : s[std::min(s.size() - 1,
+                                              std::size_t(q * double(s.size())))];
+        };
+        double seconds = std::chrono::duration<double>(r.total).count();
+        std::printf("%-44.*s %9zu %10.3f %9llu %9llu %9llu %11llu %9.1f\n",
+                    int(name.size()), name.data(), s.size(),
+                    seconds > 0 ? double(r.items) / seconds / 1e6 : 0.0,
+                    (unsigned long long) at(0.5),
+                    (unsigned long long) at(0.99),
+                    (unsigned long long) at(0.999),
+                    (unsigned long long) (s.empty() ? 0 : s.back()),
+                    double(r.peak) / double(1 << 20));
+    }
+
+    struct options {
+        std::size_t nodes = 100000;
+        std::string filter;
+        std::size_t queries = 200000;
+    };
+
+    template<class Virus, class Genealogy>
+    class suite {
+    private:
+        using id_type = typename Virus::id_type;
+
+        options const &opts;
+        std::string policy;
+        shape const &s;
+        std::vector<id_type> ids;
+        std::mt19937_64 rng{42};
+
+        bool selected(std::string const &name) const {
+            return name.find(opts.filter) != std::string::npos;
+        }
+
+        std::vector<id_type> parent_ids(std::size_t i) const {
+            std::vector<id_type> parents;
+            for (auto p: s.parents[i])
+                parents.push_back(ids[p]);
+            return parents;
+        }
+
+        void build(Genealogy &g) const {
+            for (std::size_t i = 1; i < s.size(); i++)
+                g.create(ids[i], parent_ids(i));
+        }
+
+        std::vector<id_type> stem_children() const {
+            std::vector<id_type> children;
+            for (std::size_t i = 1; i < s.size(); i++)
+                if (std::ranges::count(s.parents[i], 0) > 0)
+                    children.push_back(ids[i]);
+            return children;
+        }
+
+        std::vector<std::size_t> random_nodes(std::size_t count) {
+            std::uniform_int_distribution<std::size_t> pick(0, s.size() - 1);
+            std::vector<std::size_t> nodes(count);
+            for (auto &n: nodes)
+                n = pick(rng);
+            return nodes;
+        }
+
+        template<class F>
+        void run(std::string_view op, F &&f) {
+            auto name = policy + "/" + s.name + "/" + std::string(op);
+            if (!selected(name))
+                return;
+            counting_resource resource;
+            result r;
+            {
+                Genealogy g(ids[0], &resource);
+                f(g, r);
+            }
+            r.peak = resource.peak();
+            report(name, r);
+        }
+
+    public:
+        suite(options const &o, std::string name, shape const &sh)
+                : opts(o), policy(std::move(name)), s(sh) {
+            for (std::size_t i = 0; i < s.size(); i++)
+                ids.push_back(make_id<id_type>(i));
+        }
+
+        void operator()() {
+            run("create", [&](Genealogy &g, result &r) {
+                for (std::size_t i = 1; i < s.size(); i++) {
+                    auto parents = parent_ids(i);
+                    if (parents.size() == 1)
+                        timed(r, [&] { g.create(ids[i], parents[0]); });
+                    else
+                        timed(r, [&] { g.create(ids[i], parents); });
+                }
+                r.items = r.samples.size();
+            });
+
+            run("bulk_create", [&](Genealogy &g, result &r) {
+                std::vector<std::pair<id_type, std::vector<id_type>>> records;
+                for (std::size_t i = 1; i < s.size(); i++)
+                    records.emplace_back(ids[i], parent_ids(i));
+                timed(r, [&] { g.bulk_create(records); });
+                r.items = records.size();
+            });
+
+            run("batch_create", [&](Genealogy &g, result &r) {
+                constexpr std::size_t batch_size = 1024;
+                for (std::size_t i = 1; i < s.size(); i += batch_size) {
+                    auto end = std::min(s.size(), i + batch_size);
+                    std::vector<std::vector<id_type>> parents;
+                    for (auto j = i; j < end; j++)
+                        parents.push_back(parent_ids(j));
+                    timed(r, [&] {
+                        auto batch = g.batch();
+                        for (auto j = i; j < end; j++)
+                            batch.create(ids[j], parents[j - i]);
+                        batch.commit();
+                    });
+                }
+                r.items = s.size() - 1;
+            });
+
+            // Connects every node with a random earlier one, which may
+            // already be its parent.
+            run("connect", [&](Genealogy &g, result &r) {
+                build(g);
+                for (std::size_t i = 2; i < s.size(); i++) {
+                    auto p = std::uniform_int_distribution<std::size_t>(
+                            0, i - 1)(rng);
+                    timed(r, [&] { g.connect(ids[i], ids[p]); });
+                }
+                r.items = r.samples.size();
+            });
+
+            run("exists", [&](Genealogy &g, result &r) {
+                build(g);
+                // Every other query asks for an id which is not there.
+                auto missing = make_id<id_type>(s.size() + 1);
+                for (auto n: random_nodes(opts.queries)) {
+                    auto const &id = n % 2 ? ids[n] : missing;
+                    timed(r, [&] { keep(g.exists(id)); });
+                }
+                r.items = r.samples.size();
+            });
+
+            run("operator[]", [&](Genealogy &g, result &r) {
+                build(g);
+                for (auto n: random_nodes(opts.queries))
+                    timed(r, [&] { keep(g[ids[n]]); });
+                r.items = r.samples.size();
+            });
+
+            run("get_parents", [&](Genealogy &g, result &r) {
+                build(g);
+                for (auto n: random_nodes(opts.queries))
+                    timed(r, [&] { r.items += g.get_parents(ids[n]).size(); });
+            });
+
+            run("parents_view", [&](Genealogy &g, result &r) {
+                build(g);
+                for (auto n: random_nodes(opts.queries)) {
+                    timed(r, [&] {
+                        for (auto const &v: g.get_parents_view(ids[n])) {
+                            keep(v);
+                            r.items++;
+                        }
+                    });
+                }
+            });
+
+            // Visits children of the stem and of random nodes; with
+            // the fan-out shape the stem has all other nodes as children.
+            run("children", [&](Genealogy &g, result &r) {
+                build(g);
+                auto nodes = random_nodes(std::max<std::size_t>(
+                        opts.queries / 64, 1));
+                nodes[0] = 0;
+                for (auto n: nodes) {
+                    timed(r, [&] {
+                        auto end = g.get_children_end(ids[n]);
+                        for (auto it = g.get_children_begin(ids[n]);
+                             it != end; ++it) {
+                            keep(*it);
+                            r.items++;
+                        }
+                    });
+                }
+            });
+
+            // Removes nodes in random order, skipping nodes already removed
+            // by cascades of earlier removals.
+            run("remove_random", [&](Genealogy &g, result &r) {
+                build(g);
+                std::vector<std::size_t> order(s.size() - 1);
+                for (std::size_t i = 0; i < order.size(); i++)
+                    order[i] = i + 1;
+                std::shuffle(order.begin(), order.end(), rng);
+                for (auto n: order)
+                    if (g.exists(ids[n]))
+                        timed(r, [&] { g.remove(ids[n]); });
+                r.items = order.size();
+            });
+
+            // Removes children of the stem, which removes every other node.
+            // In the chain it is a single cascade through all of them.
+            run("remove_cascade", [&](Genealogy &g, result &r) {
+                build(g);
+                for (auto const &id: stem_children())
+                    if (g.exists(id))
+                        timed(r, [&] { g.remove(id); });
+                r.items = s.size() - 1;
+            });
+
+            // Same as above, removing each cascade in parallel.
+            run("parallel_remove", [&](Genealogy &g, result &r) {
+                build(g);
+                for (auto const &id: stem_children())
+                    if (g.exists(id))
+                        timed(r, [&] { g.parallel_remove(id); });
+                r.items = s.size() - 1;
+            });
+        }
+    };
+
+    template<class Virus, class Storage, class Index>
+    void bench(options const &opts, std::vector<shape> const &shapes,
+               std::string const &policy) {
+        for (auto const &s: shapes)
+            suite<Virus, VirusGenealogy<Virus, Storage, Index>>(
+                    opts, policy, s)();
+    }
+}
+
+int main(int argc, char **argv) {
+    options opts;
+    if (argc > 1)
+        opts.nodes = std::max<std::size_t>(std::strtoull(argv[1], nullptr, 10), 2);
+    if (argc > 2)
+        opts.filter = argv[2];
+
+    std::mt19937_64 rng(7);
+    std::vector<shape> shapes{deep_chain(opts.nodes), wide_fan_out(opts.nodes),
+                              dense_dag(opts.nodes, rng)};
+
+    std::printf("%-44s %9s %10s %9s %9s %9s %11s %9s\n", "case", "calls",
+                "Mitems/s", "p50 ns", "p99 ns", "p99.9 ns", "max ns",
+                "peak MiB");
+
+    bench<StringVirus, SharedNodeStorage, MapIndex>(
+            opts, shapes, "string/shared+map");
+    bench<StringVirus, DenseIndexStorage, HashIndex>(
+            opts, shapes, "string/dense+hash");
+    bench<StringVirus, SortedDenseIndexStorage, HashIndex>(
+            opts, shapes, "string/sorted+hash");
+    bench<StringVirus, SnapshotStorage, SnapshotHashIndex>(
+            opts, shapes, "string/snapshot+hash");
+    bench<IntVirus, DenseIndexStorage, HashIndex>(
+            opts, shapes, "int/dense+hash");
+    bench<IntVirus, DenseIndexStorage, DirectIndex>(
+            opts, shapes, "int/dense+direct");
+
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    std::printf("peak resident set size: %.1f MiB\n",
+                double(usage.ru_maxrss) / 1024.0);
+}
@@ -0,0 +1,272 @@
+#ifndef CONCURRENT_VIRUS_GENEALOGY_H
+#define CONCURRENT_VIRUS_GENEALOGY_H
+
+#include <algorithm>
+#include <chrono>
+#include <concepts>
+#include <condition_variable>
+#include <mutex>
+#include <ranges>
+#include <shared_mutex>
+#include <stop_token>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "virus_genealogy.h"
+
+// VirusGenealogy which can be shared between threads. Any number of readers
+// run in parallel, writers are serialized and exclude readers for the time
+// of a single operation. Every operation gives the same exception
+// guarantee as the corresponding operation of VirusGenealogy.
+//
+// References into the genealogy would outlive the lock, so queries return
+// copies, and visit() and read() give access to viruses and iterators
+// for the time of a callback.
+template<class Virus, class Storage = SharedNodeStorage,
+        class Index = AutoIndex, class Instrumentation = NoInstrumentation>
+class ConcurrentVirusGenealogy {
+public:
+    using genealogy_type =
+            VirusGenealogy<Virus, Storage, Index, Instrumentation>;
+
+private:
+    using virus_id_t = typename Virus::id_type;
+
+    mutable std::shared_mutex mutex;
+    genealogy_type genealogy;
+    // Copy of the id of the stem virus, which never changes, so it's read
+    // without the lock.
+    virus_id_t const stem;
+
+    // Edges and nodes torn down by the reclaimer at a time, between which
+    // other threads can take the lock.
+    static constexpr std::size_t reclaim_slice = 1024;
+    std::condition_variable_any removed;
+    // Notified once the reclaimer has nothing left.
+    mutable std::condition_variable_any reclaimed;
+    // Started by the first remove_deferred() or write(), stopped before
+    // the genealogy is destroyed.
+    std::jthread reclaimer;
+
+    void reclaim(std::stop_token stop) {
+        using namespace std::chrono_literals;
+        std::unique_lock lock(mutex);
+        while (removed.wait(lock, stop, [this] {
+            return genealogy.reclaim_pending();
+        }) && !stop.stop_requested()) {
+            bool more = true;
+            auto pause = 1ms;
+            while (more && !stop.stop_requested()) {
+                try {
+                    more = genealogy.reclaim(reclaim_slice);
+                    pause = 1ms;
+                    lock.unlock();
+                    std::this_thread::yield();
+                    lock.lock();
+                } catch (...) {
+                    // Nothing was changed, so it's tried again after
+                    // a pause, longer while it keeps failing.
+                    removed.wait_for(lock, stop, pause, [] { return false; });
+                    pause = std::min(2 * pause, 1000ms);
+                }
+            }
+            reclaimed.notify_all();
+        }
+    }
+
+    // Called with the writer lock.
+    void start_reclaimer() {
+        if (!reclaimer.joinable()) {
+            reclaimer = std::jthread([this](std::stop_token stop) {
+                reclaim(stop);
+            });
+        }
+    }
+
+    // Waits until the reclaimer tears down everything removed before.
+    template<class Lock>
+    void wait_reclaimed(Lock &lock) const {
+        reclaimed.wait(lock, [this] {
+            return !genealogy.reclaim_pending();
+        });
+    }
+
+public:
+    // Arguments are passed to the constructor of VirusGenealogy.
+    template<class... Args>
+    requires std::is_constructible_v<genealogy_type, Args...>
+    explicit ConcurrentVirusGenealogy(Args &&... args)
+            : genealogy(std::forward<Args>(args)...),
+              stem(genealogy.get_stem_id()) {}
+
+    ConcurrentVirusGenealogy(const ConcurrentVirusGenealogy &) = delete;
+
+    ConcurrentVirusGenealogy &
+    operator=(const ConcurrentVirusGenealogy &) = delete;
+
+    virus_id_t const &get_stem_id() const noexcept {
+        return stem;
+    }
+
+    template<class K>
+    bool exists(K const &id) const {
+        std::shared_lock lock(mutex);
+        return genealogy.exists(id);
+    }
+
+    template<class K>
+    std::vector<virus_id_t> get_parents(K const &id) const {
+        std::shared_lock lock(mutex);
+        return genealogy.get_parents(id);
+    }
+
+    // Returns ids of children of given virus.
+    template<class K>
+    std::vector<virus_id_t> get_children(K const &id) const {
+        std::shared_lock lock(mutex);
+        std::vector<virus_id_t> ids;
+        auto end = genealogy.get_children_end(id);
+        for (auto it = genealogy.get_children_begin(id); it != end; ++it)
+            ids.push_back(it->get_id());
+
+        return ids;
+    }
+
+    // Calls f with virus with given id and returns its result.
+    template<class K, class F>
+    decltype(auto) visit(K const &id, F &&f) const {
+        std::shared_lock lock(mutex);
+        return std::forward<F>(f)(genealogy[id]);
+    }
+
+    // Both are counted atomically, so no lock is needed.
+    GenealogyMemoryUsage memory_usage() const noexcept {
+        return genealogy.memory_usage();
+    }
+
+    GenealogyStats stats() const requires requires(genealogy_type const &g) {
+        g.stats();
+    } {
+        return genealogy.stats();
+    }
+
+    // Calls f with the whole genealogy, which no writer changes until
+    // f returns.
+    template<class F>
+    decltype(auto) read(F &&f) const {
+        std::shared_lock lock(mutex);
+        wait_reclaimed(lock);
+        return std::forward<F>(f)(std::as_const(genealogy));
+    }
+
+    void create(virus_id_t const &id, virus_id_t const &parent_id) {
+        std::unique_lock lock(mutex);
+        genealogy.create(id, parent_id);
+    }
+
+    void create(virus_id_t const &id,
+                std::vector<virus_id_t> const &parent_ids) {
+        std::unique_lock lock(mutex);
+        genealogy.create(id, parent_ids);
+    }
+
+    // Arguments are evaluated before taking the lock, so a payload is
+    // only moved in while holding it.
+    template<class... Args>
+    void emplace(virus_id_t id, virus_id_t const &parent_id,
+                 Args &&... args) {
+        std::unique_lock lock(mutex);
+        genealogy.emplace(std::move(id), parent_id,
+                          std::forward<Args>(args)...);
+    }
+
+    template<class... Args>
+    void emplace(virus_id_t id, std::vector<virus_id_t> const &parent_ids,
+                 Args &&... args) {
+        std::unique_lock lock(mutex);
+        genealogy.emplace(std::move(id), parent_ids,
+                          std::forward<Args>(args)...);
+    }
+
+    void connect(virus_id_t const &child_id, virus_id_t const &parent_id) {
+        std::unique_lock lock(mutex);
+        genealogy.connect(child_id, parent_id);
+    }
+
+    template<std::ranges::input_range R>
+    requires std::convertible_to<std::ranges::range_reference_t<R>,
+            virus_id_t const &>
+    void connect(virus_id_t const &child_id, R &&parent_ids) {
+        std::unique_lock lock(mutex);
+        genealogy.connect(child_id, std::forward<R>(parent_ids));
+    }
+
+    template<class K>
+    void remove(K const &id) {
+        std::unique_lock lock(mutex);
+        genealogy.remove(id);
+    }
+
+    // Removes virus like VirusGenealogy::remove_deferred() and leaves
+    // tearing down its cascade to a background thread, which does it in
+    // slices. Meanwhile exists(), get_parents(), get_children() and visit()
+    // treat the removed viruses as gone, while read(), snapshot() and
+    // write() wait until they are torn down.
+    template<class K>
+    void remove_deferred(K const &id) {
+        std::unique_lock lock(mutex);
+        start_reclaimer();
+        genealogy.remove_deferred(id);
+        removed.notify_one();
+    }
+
+    template<class K>
+    void parallel_remove(K const &id, std::size_t threads = 0) {
+        std::unique_lock lock(mutex);
+        genealogy.parallel_remove(id, threads);
+    }
+
+    void reserve(std::size_t nodes, std::size_t edges = 0) {
+        std::unique_lock lock(mutex);
+        genealogy.reserve(nodes, edges);
+    }
+
+    void compact() {
+        std::unique_lock lock(mutex);
+        genealogy.compact();
+    }
+
+    // Takes the writer lock, since sharing chunks with the snapshot
+    // changes their reference counts and allocates from the memory
+    // resource of the genealogy. The snapshot itself needs no locking.
+    auto snapshot() const requires requires(genealogy_type const &g) {
+        g.snapshot();
+    } {
+        std::unique_lock lock(mutex);
+        wait_reclaimed(lock);
+        return genealogy.snapshot();
+    }
+
+    // Calls f with the genealogy, excluding all other threads until
+    // f returns. Meant for batches and bulk loading. Viruses removed by
+    // f with remove_deferred() are torn down by the background thread,
+    // which is started before f runs.
+    template<class F>
+    decltype(auto) write(F &&f) {
+        std::unique_lock lock(mutex);
+        wait_reclaimed(lock);
+        start_reclaimer();
+        struct notifier {
+            std::condition_variable_any &removed;
+
+            ~notifier() {
+                removed.notify_one();
+            }
+        } notify{removed};
+        return std::forward<F>(f)(genealogy);
+    }
+};
+
+#endif //CONCURRENT_VIRUS_GENEALOGY_H
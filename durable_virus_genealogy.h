@@ -0,0 +1,549 @@
+#ifndef DURABLE_VIRUS_GENEALOGY_H
+#define DURABLE_VIRUS_GENEALOGY_H
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mapped_virus_genealogy.h"
+#include "virus_genealogy.h"
+
+// VirusGenealogy kept on disk in a directory, as the last checkpoint and
+// an append-only log of operations applied since it was written:
+// - checkpoint.<n> is a genealogy file written by save(),
+// - log.<n> holds operations applied after checkpoint.<n> was taken; log.0
+//   holds operations applied to a new genealogy.
+// On construction the genealogy is recovered from the newest checkpoint
+// and the logs which follow it. A log record which wasn't written
+// completely before a crash is dropped.
+//
+// Every changing operation returns once its record is on disk. Records of
+// operations of concurrent threads are synced together, by the first
+// thread which waits for them (group commit). Once the log grows above
+// given size, a checkpoint replaces it, which bounds the recovery time.
+// Reads run in parallel as in ConcurrentVirusGenealogy.
+template<class Virus, class Storage = SharedNodeStorage,
+        class Index = AutoIndex, class Instrumentation = NoInstrumentation>
+class DurableVirusGenealogy {
+public:
+    using genealogy_type =
+            VirusGenealogy<Virus, Storage, Index, Instrumentation>;
+
+private:
+    using virus_id_t = typename Virus::id_type;
+    using serializer = VirusSerializer<Virus>;
+
+    enum class action : std::uint8_t {
+        create, connect, remove
+    };
+
+    std::filesystem::path directory;
+    std::size_t checkpoint_bytes;
+
+    // Guards the genealogy.
+    mutable std::shared_mutex mutex;
+    std::optional<genealogy_type> genealogy;
+    // The stem id given to the constructor, which recovery checks against
+    // the checkpoint, so get_stem_id() needs no lock.
+    virus_id_t const stem;
+
+    // Guards the log, taken inside mutex while appending.
+    std::mutex log_mutex;
+    std::condition_variable synced;
+    int log_fd = -1;
+    std::uint64_t generation = 0;
+    // Records not written yet, and numbers of records appended, and
+    // written and synced.
+    std::string pending;
+    std::uint64_t appended = 0, durable = 0;
+    std::uint64_t log_size = 0;
+    bool flushing = false;
+    // Set if writing the log failed; further changes are refused, since
+    // the log no longer matches the genealogy.
+    std::exception_ptr failure;
+
+    // Serializes checkpoints.
+    std::mutex checkpoint_mutex;
+
+    static std::uint32_t checksum(std::string_view bytes) noexcept {
+        std::uint32_t hash = 2166136261u;
+        for (unsigned char c: bytes)
+            hash = (hash ^ c) * 16777619u;
+        return hash;
+    }
+
+    static void put(std::string &out, std::uint32_t value) {
+        out.append(reinterpret_cast<char const *>(&value), sizeof(value));
+    }
+
+    static std::uint32_t get(std::string_view &in) {
+        if (in.size() < sizeof(std::uint32_t))
+            throw InvalidGenealogyFile();
+        std::uint32_t value;
+        std::memcpy(&value, in.data(), sizeof(value));
+        in.remove_prefix(sizeof(value));
+        return value;
+    }
+
+    static void put_id(std::string &out, virus_id_t const &id) {
+        auto size = out.size();
+        put(out, 0);
+        serializer::encode(id, out);
+        auto length = std::uint32_t(out.size() - size - sizeof(std::uint32_t));
+        std::memcpy(out.data() + size, &length, sizeof(length));
+    }
+
+    static virus_id_t get_id(std::string_view &in) {
+        auto length = get(in);
+        if (in.size() < length)
+            throw InvalidGenealogyFile();
+        auto id = serializer::decode(in.substr(0, length));
+        in.remove_prefix(length);
+        return id;
+    }
+
+    // Record: payload size, checksum of the payload and the payload, which
+    // is the action, the number of ids and the ids, each as its size and
+    // bytes.
+    static std::string record(action type, virus_id_t const &id,
+                              std::vector<virus_id_t> const &parent_ids) {
+        std::string payload;
+        payload.push_back(char(type));
+        put(payload, std::uint32_t(1 + parent_ids.size()));
+        put_id(payload, id);
+        for (auto const &parent: parent_ids)
+            put_id(payload, parent);
+
+        std::string result;
+        put(result, std::uint32_t(payload.size()));
+        put(result, checksum(payload));
+        return result + payload;
+    }
+
+    // Applies records of the log and returns size of its complete prefix.
+    std::size_t replay(std::string_view log) {
+        std::size_t good = 0;
+        std::string_view rest = log;
+        while (rest.size() >= 2 * sizeof(std::uint32_t)) {
+            auto size = get(rest);
+            auto sum = get(rest);
+            if (rest.size() < size || checksum(rest.substr(0, size)) != sum)
+                break;
+            auto payload = rest.substr(0, size);
+            rest.remove_prefix(size);
+
+            if (payload.empty())
+                throw InvalidGenealogyFile();
+            auto type = action(payload[0]);
+            payload.remove_prefix(1);
+            auto count = get(payload);
+            if (count == 0)
+                throw InvalidGenealogyFile();
+            auto id = get_id(payload);
+            std::vector<virus_id_t> parent_ids;
+            for (std::uint32_t i = 1; i < count; i++)
+                parent_ids.push_back(get_id(payload));
+
+            switch (type) {
+                case action::create:
+                    genealogy->create(id, parent_ids);
+                    break;
+                case action::connect:
+                    if (parent_ids.size() != 1)
+                        throw InvalidGenealogyFile();
+                    genealogy->connect(id, parent_ids[0]);
+                    break;
+                case action::remove:
+                    genealogy->remove(id);
+                    break;
+                default:
+                    throw InvalidGenealogyFile();
+            }
+            good = log.size() - rest.size();
+        }
+        return good;
+    }
+
+    std::filesystem::path file(char const *name, std::uint64_t n) const {
+        return directory / (std::string(name) + "." + std::to_string(n));
+    }
+
+    static void check(bool ok, char const *what) {
+        if (!ok)
+            throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    static void write_all(int fd, std::string_view data) {
+        while (!data.empty()) {
+            auto n = ::write(fd, data.data(), data.size());
+            if (n < 0 && errno == EINTR)
+                continue;
+            check(n >= 0, "write");
+            data.remove_prefix(std::size_t(n));
+        }
+    }
+
+    void sync_directory() const {
+        int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        check(fd >= 0, "open");
+        int result = fsync(fd);
+        int error = errno;
+        close(fd);
+        errno = error;
+        check(result == 0, "fsync");
+    }
+
+    int open_log(std::uint64_t n) const {
+        int fd = open(file("log", n).c_str(),
+                      O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        check(fd >= 0, "open");
+        return fd;
+    }
+
+    static std::string read_file(std::filesystem::path const &path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        check(fd >= 0, "open");
+        std::string data;
+        while (true) {
+            auto old = data.size();
+            data.resize(old + (1 << 16));
+            auto n = ::read(fd, data.data() + old, 1 << 16);
+            if (n < 0 && errno == EINTR) {
+                data.resize(old);
+                continue;
+            }
+            if (n <= 0) {
+                int error = errno;
+                close(fd);
+                errno = error;
+                check(n == 0, "read");
+                data.resize(old);
+                return data;
+            }
+            data.resize(old + std::size_t(n));
+        }
+    }
+
+    // Numbers of files of given kind in the directory.
+    std::vector<std::uint64_t> generations(std::string_view kind) const {
+        std::vector<std::uint64_t> result;
+        for (auto const &entry: std::filesystem::directory_iterator(directory)) {
+            auto name = entry.path().filename().string();
+            if (name.size() <= kind.size() + 1 || !name.starts_with(kind) ||
+                name[kind.size()] != '.')
+                continue;
+            std::uint64_t n;
+            auto begin = name.data() + kind.size() + 1;
+            auto end = name.data() + name.size();
+            auto [ptr, error] = std::from_chars(begin, end, n);
+            if (error == std::errc() && ptr == end)
+                result.push_back(n);
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    void recover(virus_id_t const &stem_id) {
+        std::filesystem::create_directories(directory);
+        for (auto const &entry: std::filesystem::directory_iterator(directory)) {
+            if (entry.path().extension() == ".tmp")
+                std::filesystem::remove(entry.path());
+        }
+
+        auto checkpoints = generations("checkpoint");
+        generation = checkpoints.empty() ? 0 : checkpoints.back();
+        if (checkpoints.empty()) {
+            genealogy.emplace(stem_id);
+        } else {
+            auto mapped = load_mmap<Virus>(file("checkpoint", generation));
+            if (!(mapped.get_stem_id() == stem_id))
+                throw InvalidGenealogyFile();
+            std::vector<std::pair<virus_id_t, std::vector<virus_id_t>>> records;
+            records.reserve(mapped.size());
+            mapped.for_each_node([&](virus_id_t const &id,
+                                     std::vector<virus_id_t> const &parents) {
+                records.emplace_back(id, parents);
+            });
+            genealogy.emplace(stem_id);
+            genealogy->bulk_create(records);
+        }
+
+        // Logs after the checkpoint which wasn't written completely are
+        // replayed too.
+        for (auto n = generation;; n++) {
+            if (!std::filesystem::exists(file("log", n)))
+                break;
+            auto data = read_file(file("log", n));
+            auto good = replay(data);
+            generation = n;
+            if (good < data.size()) {
+                std::filesystem::resize_file(file("log", n), good);
+                data.resize(good);
+            }
+            log_size = data.size();
+        }
+        log_fd = open_log(generation);
+        sync_directory();
+    }
+
+    // Waits until records up to given number are synced, writing them
+    // if no other thread does.
+    void wait_durable(std::unique_lock<std::mutex> &lock, std::uint64_t upto) {
+        while (durable < upto) {
+            if (failure)
+                std::rethrow_exception(failure);
+            if (flushing) {
+                synced.wait(lock);
+                continue;
+            }
+
+            flushing = true;
+            std::string data;
+            data.swap(pending);
+            auto last = appended;
+            int fd = log_fd;
+            lock.unlock();
+            std::exception_ptr error;
+            try {
+                write_all(fd, data);
+                check(fdatasync(fd) == 0, "fdatasync");
+            } catch (...) {
+                error = std::current_exception();
+            }
+            lock.lock();
+            flushing = false;
+            if (error)
+                failure = error;
+            else {
+                durable = last;
+                log_size += data.size();
+            }
+            synced.notify_all();
+        }
+        if (failure)
+            std::rethrow_exception(failure);
+    }
+
+    // Applies the operation to the genealogy and appends its record to
+    // the log, or does neither of them. Returns once the record is synced.
+    template<class Apply>
+    void change(action type, virus_id_t const &id,
+                std::vector<virus_id_t> const &parent_ids, Apply apply) {
+        auto entry = record(type, id, parent_ids);
+        std::uint64_t number;
+        {
+            std::unique_lock lock(mutex);
+            std::lock_guard log_lock(log_mutex);
+            if (failure)
+                std::rethrow_exception(failure);
+            pending.reserve(pending.size() + entry.size());
+            apply(*genealogy);
+            pending.append(entry);
+            number = ++appended;
+        }
+
+        bool full;
+        {
+            std::unique_lock log_lock(log_mutex);
+            wait_durable(log_lock, number);
+            full = log_size >= checkpoint_bytes;
+        }
+        if (full)
+            checkpoint_if_full();
+    }
+
+    // Writers which filled the log together wait for one checkpoint, so
+    // the size is checked again once it's their turn.
+    void checkpoint_if_full() {
+        std::lock_guard serial(checkpoint_mutex);
+        {
+            std::lock_guard log_lock(log_mutex);
+            if (log_size < checkpoint_bytes)
+                return;
+        }
+        write_checkpoint();
+    }
+
+    // Has to be called with checkpoint_mutex held.
+    void write_checkpoint() {
+        std::unique_lock lock(mutex);
+        auto next = generation + 1;
+        int fd = open_log(next);
+        int old_fd;
+        try {
+            sync_directory();
+            std::unique_lock log_lock(log_mutex);
+            wait_durable(log_lock, appended);
+            old_fd = std::exchange(log_fd, fd);
+            generation = next;
+            log_size = 0;
+        } catch (...) {
+            close(fd);
+            std::filesystem::remove(file("log", next));
+            throw;
+        }
+        close(old_fd);
+
+        auto write = [&](genealogy_type const &g) {
+            auto path = file("checkpoint", next);
+            auto temporary = path;
+            temporary += ".tmp";
+            save(g, temporary.string());
+            int out = open(temporary.c_str(), O_RDONLY | O_CLOEXEC);
+            check(out >= 0, "open");
+            int result = fsync(out);
+            int error = errno;
+            close(out);
+            errno = error;
+            check(result == 0, "fsync");
+            std::filesystem::rename(temporary, path);
+            sync_directory();
+        };
+        if constexpr (requires { genealogy->snapshot(); }) {
+            auto snapshot = genealogy->snapshot();
+            lock.unlock();
+            write(*snapshot);
+        } else {
+            write(*genealogy);
+            lock.unlock();
+        }
+
+        for (auto n: generations("checkpoint")) {
+            if (n < next)
+                std::filesystem::remove(file("checkpoint", n));
+        }
+        for (auto n: generations("log")) {
+            if (n < next)
+                std::filesystem::remove(file("log", n));
+        }
+    }
+
+public:
+    // Opens the genealogy kept in given directory, creating it with given
+    // stem virus if there is none.
+    DurableVirusGenealogy(std::filesystem::path dir, virus_id_t const &stem_id,
+                          std::size_t log_limit = std::size_t(1) << 26)
+            : directory(std::move(dir)), checkpoint_bytes(log_limit),
+              stem(stem_id) {
+        try {
+            recover(stem_id);
+        } catch (...) {
+            if (log_fd >= 0)
+                close(log_fd);
+            throw;
+        }
+    }
+
+    DurableVirusGenealogy(const DurableVirusGenealogy &) = delete;
+
+    DurableVirusGenealogy &operator=(const DurableVirusGenealogy &) = delete;
+
+    // Unsynced records exist only if writing the log failed.
+    ~DurableVirusGenealogy() noexcept {
+        close(log_fd);
+    }
+
+    virus_id_t const &get_stem_id() const noexcept {
+        return stem;
+    }
+
+    template<class K>
+    bool exists(K const &id) const {
+        std::shared_lock lock(mutex);
+        return genealogy->exists(id);
+    }
+
+    template<class K>
+    std::vector<virus_id_t> get_parents(K const &id) const {
+        std::shared_lock lock(mutex);
+        return genealogy->get_parents(id);
+    }
+
+    // Same as in ConcurrentVirusGenealogy. The genealogy is only replaced
+    // during recovery, before the object is shared.
+    GenealogyMemoryUsage memory_usage() const noexcept {
+        return genealogy->memory_usage();
+    }
+
+    GenealogyStats stats() const requires requires(genealogy_type const &g) {
+        g.stats();
+    } {
+        return genealogy->stats();
+    }
+
+    // Calls f with the whole genealogy, which no writer changes until
+    // f returns.
+    template<class F>
+    decltype(auto) read(F &&f) const {
+        std::shared_lock lock(mutex);
+        return std::forward<F>(f)(std::as_const(*genealogy));
+    }
+
+    void create(virus_id_t const &id, virus_id_t const &parent_id) {
+        create(id, std::vector<virus_id_t>{parent_id});
+    }
+
+    void create(virus_id_t const &id,
+                std::vector<virus_id_t> const &parent_ids) {
+        change(action::create, id, parent_ids, [&](genealogy_type &g) {
+            g.create(id, parent_ids);
+        });
+    }
+
+    void connect(virus_id_t const &child_id, virus_id_t const &parent_id) {
+        change(action::connect, child_id, {parent_id},
+               [&](genealogy_type &g) {
+                   g.connect(child_id, parent_id);
+               });
+    }
+
+    void remove(virus_id_t const &id) {
+        change(action::remove, id, {}, [&](genealogy_type &g) {
+            g.remove(id);
+        });
+    }
+
+    // Reserves only memory, so nothing is logged.
+    void reserve(std::size_t nodes, std::size_t edges = 0) {
+        std::unique_lock lock(mutex);
+        genealogy->reserve(nodes, edges);
+    }
+
+    // Changes only the layout in memory, so nothing is logged.
+    void compact() {
+        std::unique_lock lock(mutex);
+        genealogy->compact();
+    }
+
+    // Writes a checkpoint of the current genealogy and starts a new log,
+    // then drops older files. Changes wait meanwhile, unless
+    // the genealogy supports snapshots: then only taking the snapshot
+    // excludes them.
+    void checkpoint() {
+        std::lock_guard serial(checkpoint_mutex);
+        write_checkpoint();
+    }
+
+    // Returns once all changes made so far are on disk.
+    void sync() {
+        std::unique_lock log_lock(log_mutex);
+        wait_durable(log_lock, appended);
+    }
+};
+
+#endif //DURABLE_VIRUS_GENEALOGY_H
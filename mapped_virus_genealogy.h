@@ -0,0 +1,542 @@
+#ifndef MAPPED_VIRUS_GENEALOGY_H
+#define MAPPED_VIRUS_GENEALOGY_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "virus_genealogy.h"
+
+class InvalidGenealogyFile : public std::exception {
+public:
+    const char *what() const noexcept override {
+        return "InvalidGenealogyFile";
+    }
+};
+
+// Conversion of virus ids to bytes and back, used by genealogy files.
+// Equal ids have to give equal bytes. Ids which strings can be made from
+// and trivially copyable ids are supported, other ones need
+// a specialization with the same members.
+template<class Virus>
+struct VirusSerializer {
+    using id_type = typename Virus::id_type;
+
+    static void encode(id_type const &id, std::string &out) {
+        if constexpr (std::is_convertible_v<id_type const &,
+                                            std::string_view>) {
+            out.append(std::string_view(id));
+        } else {
+            static_assert(std::is_trivially_copyable_v<id_type>,
+                          "VirusSerializer has to be specialized");
+            out.append(reinterpret_cast<char const *>(&id), sizeof(id));
+        }
+    }
+
+    static id_type decode(std::string_view bytes) {
+        if constexpr (std::is_convertible_v<id_type const &,
+                                            std::string_view>) {
+            return id_type(bytes);
+        } else {
+            id_type id;
+            if (bytes.size() != sizeof(id))
+                throw InvalidGenealogyFile();
+            std::memcpy(&id, bytes.data(), sizeof(id));
+            return id;
+        }
+    }
+};
+
+// Layout of genealogy files, in native byte order. Nodes are numbered in
+// the order of bytes of their ids, so that an id is found by binary
+// search. The header is followed by 8-byte aligned sections:
+// - id offsets, children offsets and parents offsets, nodes + 1 of each,
+//   so that edges of node i are [offsets[i], offsets[i + 1]),
+// - children and parents, edges node numbers of each,
+// - bytes of all ids.
+namespace genealogy_file {
+    inline constexpr char magic[8] = {'V', 'G', 'E', 'N', 'E', 'A', 'L', '1'};
+    inline constexpr std::uint32_t byte_order = 0x01020304;
+
+    struct header {
+        char magic[8];
+        std::uint32_t byte_order;
+        std::uint32_t stem;
+        std::uint64_t nodes;
+        std::uint64_t edges;
+        std::uint64_t id_bytes;
+    };
+
+    // Positions of sections, in bytes from the beginning of the file.
+    struct layout {
+        std::uint64_t id_offsets, children_offsets, parents_offsets;
+        std::uint64_t children, parents, ids, size;
+
+        explicit layout(header const &h) {
+            auto aligned = [](std::uint64_t n) { return (n + 7) & ~7ull; };
+            std::uint64_t offsets = 8 * (h.nodes + 1);
+            id_offsets = aligned(sizeof(header));
+            children_offsets = id_offsets + offsets;
+            parents_offsets = children_offsets + offsets;
+            children = parents_offsets + offsets;
+            parents = children + aligned(4 * h.edges);
+            ids = parents + aligned(4 * h.edges);
+            size = ids + h.id_bytes;
+        }
+    };
+}
+
+// Writes the whole genealogy to a stream in the format read by
+// load_mmap(). Throws std::ios_base::failure if writing fails.
+template<class Virus, class Storage, class Index, class Instrumentation>
+void save(VirusGenealogy<Virus, Storage, Index, Instrumentation> const
+          &genealogy, std::ostream &out) {
+    using serializer = VirusSerializer<Virus>;
+    using id_type = typename Virus::id_type;
+
+    std::vector<id_type> ids;
+    genealogy.for_each_node([&](Virus const &virus) {
+        ids.push_back(virus.get_id());
+    }, 1);
+
+    std::vector<std::string> bytes(ids.size());
+    for (std::size_t i = 0; i < ids.size(); i++)
+        serializer::encode(ids[i], bytes[i]);
+    std::vector<std::uint32_t> order(ids.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](auto a, auto b) {
+        return bytes[a] < bytes[b];
+    });
+
+    std::unordered_map<std::string_view, std::uint32_t> numbers;
+    for (std::uint32_t n = 0; n < order.size(); n++)
+        numbers.emplace(bytes[order[n]], n);
+    std::string key;
+    auto number = [&](id_type const &id) {
+        key.clear();
+        serializer::encode(id, key);
+        return numbers.at(key);
+    };
+
+    std::vector<std::uint64_t> id_offsets{0}, children_offsets{0},
+            parents_offsets{0};
+    std::vector<std::uint32_t> children, parents;
+    for (auto i: order) {
+        id_offsets.push_back(id_offsets.back() + bytes[i].size());
+        auto end = genealogy.get_children_end(ids[i]);
+        for (auto it = genealogy.get_children_begin(ids[i]); it != end; ++it)
+            children.push_back(number(it->get_id()));
+        children_offsets.push_back(children.size());
+        for (auto const &parent: genealogy.get_parents(ids[i]))
+            parents.push_back(number(parent));
+        parents_offsets.push_back(parents.size());
+    }
+
+    genealogy_file::header h{};
+    std::copy(std::begin(genealogy_file::magic),
+              std::end(genealogy_file::magic), h.magic);
+    h.byte_order = genealogy_file::byte_order;
+    h.stem = number(genealogy.get_stem_id());
+    h.nodes = ids.size();
+    h.edges = children.size();
+    h.id_bytes = id_offsets.back();
+    genealogy_file::layout l(h);
+
+    auto exceptions = out.exceptions();
+    out.exceptions(std::ios_base::failbit | std::ios_base::badbit);
+    std::uint64_t written = 0;
+    auto write = [&](void const *data, std::size_t size) {
+        out.write(static_cast<char const *>(data),
+                  static_cast<std::streamsize>(size));
+        written += size;
+    };
+    auto pad = [&](std::uint64_t position) {
+        static constexpr char zeros[8] = {};
+        write(zeros, position - written);
+    };
+    try {
+        write(&h, sizeof(h));
+        pad(l.id_offsets);
+        write(id_offsets.data(), 8 * id_offsets.size());
+        write(children_offsets.data(), 8 * children_offsets.size());
+        write(parents_offsets.data(), 8 * parents_offsets.size());
+        write(children.data(), 4 * children.size());
+        pad(l.parents);
+        write(parents.data(), 4 * parents.size());
+        pad(l.ids);
+        for (auto i: order)
+            write(bytes[i].data(), bytes[i].size());
+    } catch (...) {
+        out.exceptions(exceptions);
+        throw;
+    }
+    out.exceptions(exceptions);
+}
+
+template<class Virus, class Storage, class Index, class Instrumentation>
+void save(VirusGenealogy<Virus, Storage, Index, Instrumentation> const
+          &genealogy, std::string const &path) {
+    std::ofstream out;
+    out.exceptions(std::ios_base::failbit | std::ios_base::badbit);
+    out.open(path, std::ios_base::binary | std::ios_base::trunc);
+    save(genealogy, out);
+    out.close();
+}
+
+// Read-only genealogy read directly from a memory-mapped file written by
+// save(). Opening it checks all offsets, node numbers and the order of
+// ids once, in one pass over the file, then walks the graph down from the
+// stem once to check that children match parents and every node is
+// reached. It throws InvalidGenealogyFile if some check fails. Nodes,
+// edges and ids are then read from the mapping as queries need them, and
+// viruses are made from their ids on every access.
+template<class Virus>
+class MappedVirusGenealogy {
+private:
+    using virus_id_t = typename Virus::id_type;
+    using serializer = VirusSerializer<Virus>;
+
+    // Owner of the mapping of the file.
+    class mapping {
+    private:
+        void *data = nullptr;
+        std::size_t length = 0;
+
+    public:
+        mapping(void *d, std::size_t size) noexcept : data(d), length(size) {}
+
+        mapping(mapping &&other) noexcept
+                : data(std::exchange(other.data, nullptr)),
+                  length(std::exchange(other.length, 0)) {}
+
+        mapping &operator=(mapping &&other) noexcept {
+            std::swap(data, other.data);
+            std::swap(length, other.length);
+            return *this;
+        }
+
+        ~mapping() noexcept {
+            if (data != nullptr)
+                munmap(data, length);
+        }
+
+        char const *bytes() const noexcept {
+            return static_cast<char const *>(data);
+        }
+
+        std::size_t size() const noexcept {
+            return length;
+        }
+    };
+
+    mapping file;
+    genealogy_file::header h{};
+    std::uint64_t const *id_offsets = nullptr;
+    std::uint64_t const *children_offsets = nullptr;
+    std::uint64_t const *parents_offsets = nullptr;
+    std::uint32_t const *children = nullptr;
+    std::uint32_t const *parents = nullptr;
+    char const *ids = nullptr;
+
+    std::string_view bytes(std::uint32_t node) const noexcept {
+        return {ids + id_offsets[node],
+                std::size_t(id_offsets[node + 1] - id_offsets[node])};
+    }
+
+    virus_id_t id(std::uint32_t node) const {
+        return serializer::decode(bytes(node));
+    }
+
+    std::uint32_t none() const noexcept {
+        return std::uint32_t(h.nodes);
+    }
+
+    // Returns number of the node with given id or none() if there is none.
+    std::uint32_t find(virus_id_t const &id) const {
+        std::string key;
+        serializer::encode(id, key);
+        std::uint32_t low = 0, high = std::uint32_t(h.nodes);
+        while (low < high) {
+            auto middle = low + (high - low) / 2;
+            if (bytes(middle) < key)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        return low < none() && bytes(low) == key ? low : none();
+    }
+
+    std::uint32_t find_node(virus_id_t const &id) const {
+        auto node = find(id);
+        if (node == none())
+            throw VirusNotFound();
+        return node;
+    }
+
+    // Takes ownership of the mapping, also if the file is invalid.
+    explicit MappedVirusGenealogy(mapping &&m) : file(std::move(m)) {
+        auto size = file.size();
+        if (size < sizeof(h))
+            throw InvalidGenealogyFile();
+        std::memcpy(&h, file.bytes(), sizeof(h));
+        if (!std::equal(std::begin(h.magic), std::end(h.magic),
+                        std::begin(genealogy_file::magic)) ||
+            h.byte_order != genealogy_file::byte_order ||
+            h.nodes == 0 ||
+            h.nodes >= std::numeric_limits<std::uint32_t>::max() ||
+            h.edges >= std::numeric_limits<std::uint32_t>::max())
+            throw InvalidGenealogyFile();
+
+        genealogy_file::layout l(h);
+        if (h.id_bytes > size || l.size > size || h.stem >= h.nodes)
+            throw InvalidGenealogyFile();
+        auto base = file.bytes();
+        id_offsets = reinterpret_cast<std::uint64_t const *>(
+                base + l.id_offsets);
+        children_offsets = reinterpret_cast<std::uint64_t const *>(
+                base + l.children_offsets);
+        parents_offsets = reinterpret_cast<std::uint64_t const *>(
+                base + l.parents_offsets);
+        children = reinterpret_cast<std::uint32_t const *>(base + l.children);
+        parents = reinterpret_cast<std::uint32_t const *>(base + l.parents);
+        ids = base + l.ids;
+        if (!valid())
+            throw InvalidGenealogyFile();
+    }
+
+    // Checks that every section stays within its bounds, which the sizes
+    // in the header were already checked against, and that ids are sorted
+    // as find() needs. The stem has to have no parents, every node has to
+    // be listed as a child as many times as it has parents, and all nodes
+    // have to be reached from the stem going down, as for_each_node() does.
+    bool valid() const {
+        auto ascending = [this](std::uint64_t const *offsets,
+                                std::uint64_t total) {
+            if (offsets[0] != 0 || offsets[h.nodes] != total)
+                return false;
+            for (std::uint64_t node = 0; node < h.nodes; node++) {
+                if (offsets[node] > offsets[node + 1])
+                    return false;
+            }
+            return true;
+        };
+        auto numbers = [this](std::uint32_t const *edges) {
+            return std::all_of(edges, edges + h.edges, [this](auto node) {
+                return node < h.nodes;
+            });
+        };
+        if (!ascending(id_offsets, h.id_bytes) ||
+            !ascending(children_offsets, h.edges) ||
+            !ascending(parents_offsets, h.edges) ||
+            !numbers(children) || !numbers(parents) ||
+            parents_offsets[h.stem] != parents_offsets[h.stem + 1])
+            return false;
+        for (std::uint32_t node = 0; node + 1 < h.nodes; node++) {
+            if (!(bytes(node) < bytes(node + 1)))
+                return false;
+        }
+
+        std::vector<std::uint32_t> pending(h.nodes);
+        for (std::uint64_t i = 0; i < h.edges; i++)
+            pending[children[i]]++;
+        for (std::uint32_t node = 0; node < h.nodes; node++) {
+            if (pending[node] != parents_offsets[node + 1] -
+                                 parents_offsets[node])
+                return false;
+        }
+        return walk(pending, [](std::uint32_t) {}) == h.nodes;
+    }
+
+    // Visits nodes from the stem, each one after all its parents, given
+    // numbers of their parents. Returns the number of visited nodes.
+    template<class F>
+    std::uint32_t walk(std::vector<std::uint32_t> &pending, F &&f) const {
+        std::vector<std::uint32_t> ready{h.stem};
+        std::uint32_t visited = 0;
+        while (!ready.empty()) {
+            auto node = ready.back();
+            ready.pop_back();
+            visited++;
+            f(node);
+            for (auto i = children_offsets[node];
+                 i < children_offsets[node + 1]; i++) {
+                if (--pending[children[i]] == 0)
+                    ready.push_back(children[i]);
+            }
+        }
+        return visited;
+    }
+
+    template<class V>
+    friend MappedVirusGenealogy<V> load_mmap(std::string const &path);
+
+public:
+    // Iterator over viruses of an edge list. Viruses are made from their
+    // ids, so it yields them by value.
+    class children_iterator {
+    private:
+        MappedVirusGenealogy const *genealogy = nullptr;
+        std::uint32_t const *current = nullptr;
+
+        friend class MappedVirusGenealogy;
+
+        children_iterator(MappedVirusGenealogy const *g,
+                          std::uint32_t const *it)
+                : genealogy(g), current(it) {}
+
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = Virus;
+        using difference_type = std::ptrdiff_t;
+        using reference = Virus;
+
+        struct pointer {
+            Virus virus;
+
+            Virus const *operator->() const noexcept {
+                return &virus;
+            }
+        };
+
+        children_iterator() = default;
+
+        Virus operator*() const {
+            return Virus(genealogy->id(*current));
+        }
+
+        pointer operator->() const {
+            return {**this};
+        }
+
+        children_iterator &operator++() noexcept {
+            ++current;
+            return *this;
+        }
+
+        children_iterator operator++(int) noexcept {
+            auto old = *this;
+            ++current;
+            return old;
+        }
+
+        friend bool operator==(children_iterator const &a,
+                               children_iterator const &b) noexcept {
+            return a.current == b.current;
+        }
+    };
+
+    using parents_iterator = children_iterator;
+
+    // A moved-from genealogy can only be destroyed or assigned to.
+    MappedVirusGenealogy(MappedVirusGenealogy &&) noexcept = default;
+
+    MappedVirusGenealogy &
+    operator=(MappedVirusGenealogy &&) noexcept = default;
+
+    virus_id_t get_stem_id() const {
+        return id(h.stem);
+    }
+
+    std::size_t size() const noexcept {
+        return h.nodes;
+    }
+
+    bool exists(virus_id_t const &id) const {
+        return find(id) != none();
+    }
+
+    Virus operator[](virus_id_t const &id) const {
+        return Virus(this->id(find_node(id)));
+    }
+
+    children_iterator get_children_begin(virus_id_t const &id) const {
+        return {this, children + children_offsets[find_node(id)]};
+    }
+
+    children_iterator get_children_end(virus_id_t const &id) const {
+        return {this, children + children_offsets[find_node(id) + 1]};
+    }
+
+    parents_iterator get_parents_begin(virus_id_t const &id) const {
+        return {this, parents + parents_offsets[find_node(id)]};
+    }
+
+    parents_iterator get_parents_end(virus_id_t const &id) const {
+        return {this, parents + parents_offsets[find_node(id) + 1]};
+    }
+
+    std::vector<virus_id_t> get_parents(virus_id_t const &id) const {
+        auto node = find_node(id);
+        std::vector<virus_id_t> result;
+        result.reserve(parents_offsets[node + 1] - parents_offsets[node]);
+        for (auto i = parents_offsets[node]; i < parents_offsets[node + 1]; i++)
+            result.push_back(this->id(parents[i]));
+        return result;
+    }
+
+    // Calls f(id, parent ids) for every virus, each one after all its
+    // parents, e.g. to rebuild a genealogy with bulk_create().
+    template<class F>
+    void for_each_node(F f) const {
+        std::vector<std::uint32_t> pending(h.nodes);
+        for (std::uint32_t node = 0; node < h.nodes; node++)
+            pending[node] = std::uint32_t(parents_offsets[node + 1] -
+                                          parents_offsets[node]);
+        std::vector<virus_id_t> parent_ids;
+        walk(pending, [&](std::uint32_t node) {
+            parent_ids.clear();
+            for (auto i = parents_offsets[node];
+                 i < parents_offsets[node + 1]; i++)
+                parent_ids.push_back(id(parents[i]));
+            f(id(node), std::as_const(parent_ids));
+        });
+    }
+};
+
+// Maps a file written by save() into memory, read-only.
+template<class Virus>
+MappedVirusGenealogy<Virus> load_mmap(std::string const &path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), path);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), path);
+    }
+    auto size = std::size_t(st.st_size);
+    if (size == 0) {
+        close(fd);
+        throw InvalidGenealogyFile();
+    }
+    void *data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    int error = errno;
+    close(fd);
+    if (data == MAP_FAILED)
+        throw std::system_error(error, std::generic_category(), path);
+
+    return MappedVirusGenealogy<Virus>(
+            typename MappedVirusGenealogy<Virus>::mapping(data, size));
+}
+
+#endif //MAPPED_VIRUS_GENEALOGY_H
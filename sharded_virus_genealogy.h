@@ -0,0 +1,353 @@
+#ifndef SHARDED_VIRUS_GENEALOGY_H
+#define SHARDED_VIRUS_GENEALOGY_H
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "virus_genealogy.h"
+
+// Genealogy partitioned into shards by hashes of ids. Every shard has its
+// own lock, index and memory pool. Edges are kept as ids on both ends, so
+// an edge between shards is a reference to the id of a virus in another
+// shard rather than to its node.
+//
+// Operations lock the shards of the viruses they touch, in order of their
+// numbers, so writers touching different shards run in parallel. remove()
+// locks all shards, since its cascade can reach any of them. Every
+// operation gives the same exception guarantee as the corresponding
+// operation of VirusGenealogy, and queries return copies as in
+// ConcurrentVirusGenealogy.
+template<class Virus, class Index = HashIndex>
+class ShardedVirusGenealogy {
+private:
+    using virus_id_t = typename Virus::id_type;
+    using id_list = std::pmr::vector<virus_id_t>;
+
+    struct record {
+        Virus virus;
+        id_list parents, children;
+
+        record(virus_id_t const &id, std::pmr::memory_resource *resource)
+                : virus(id), parents(resource), children(resource) {}
+    };
+
+    struct shard {
+        mutable std::shared_mutex mutex;
+        // Used only under the lock of the shard.
+        std::pmr::unsynchronized_pool_resource pool;
+        typename Index::template index<virus_id_t, record *> viruses{&pool};
+
+        shard() = default;
+
+        shard(shard const &) = delete;
+
+        shard &operator=(shard const &) = delete;
+
+        ~shard() {
+            viruses.for_each([this](auto const &, record *node) {
+                destroy(node);
+            });
+        }
+
+        record *make(virus_id_t const &id) {
+            return std::pmr::polymorphic_allocator<record>(&pool)
+                    .template new_object<record>(id, &pool);
+        }
+
+        void destroy(record *node) noexcept {
+            std::pmr::polymorphic_allocator<record>(&pool)
+                    .delete_object(node);
+        }
+
+        record *find(virus_id_t const &id) const {
+            auto found = viruses.find(id);
+            return found ? *found : nullptr;
+        }
+    };
+
+    using lock_list = std::vector<std::unique_lock<std::shared_mutex>>;
+
+    std::vector<std::unique_ptr<shard>> shards;
+    virus_id_t stem_id;
+
+    std::size_t shard_number(virus_id_t const &id) const {
+        return std::hash<virus_id_t>()(id) % shards.size();
+    }
+
+    shard &shard_of(virus_id_t const &id) const {
+        return *shards[shard_number(id)];
+    }
+
+    // The shard of the virus has to be locked.
+    record *find(virus_id_t const &id) const {
+        return shard_of(id).find(id);
+    }
+
+    // Locks shards with given numbers, which may repeat, in ascending
+    // order.
+    lock_list lock_shards(std::vector<std::size_t> numbers) const {
+        std::sort(numbers.begin(), numbers.end());
+        numbers.erase(std::unique(numbers.begin(), numbers.end()),
+                      numbers.end());
+        lock_list locks;
+        locks.reserve(numbers.size());
+        for (auto n: numbers)
+            locks.emplace_back(shards[n]->mutex);
+        return locks;
+    }
+
+    lock_list lock_all() const {
+        lock_list locks;
+        locks.reserve(shards.size());
+        for (auto const &s: shards)
+            locks.emplace_back(s->mutex);
+        return locks;
+    }
+
+    // Makes sure that n more ids can be appended without allocating.
+    static void make_room(id_list &list, std::size_t n = 1) {
+        if (list.capacity() - list.size() < n)
+            list.reserve(std::max(list.size() + n, 2 * list.capacity()));
+    }
+
+    static void erase_id(id_list &list, virus_id_t const &id) noexcept {
+        list.erase(std::find(list.begin(), list.end(), id));
+    }
+
+public:
+    // Creates the genealogy with the stem virus and given number of shards,
+    // by default one per hardware thread.
+    explicit ShardedVirusGenealogy(virus_id_t const &stem,
+                                   std::size_t shard_count = 0)
+            : stem_id(stem) {
+        if (shard_count == 0)
+            shard_count = std::max(1u, std::thread::hardware_concurrency());
+        shards.reserve(shard_count);
+        for (std::size_t i = 0; i < shard_count; i++)
+            shards.push_back(std::make_unique<shard>());
+
+        auto &home = shard_of(stem_id);
+        record *node = home.make(stem_id);
+        try {
+            home.viruses.insert(stem_id, node);
+        } catch (...) {
+            home.destroy(node);
+            throw;
+        }
+    }
+
+    ShardedVirusGenealogy(ShardedVirusGenealogy const &) = delete;
+
+    ShardedVirusGenealogy &operator=(ShardedVirusGenealogy const &) = delete;
+
+    // The stem virus is never removed, so no lock is needed.
+    virus_id_t const &get_stem_id() const noexcept {
+        return stem_id;
+    }
+
+    std::size_t shard_count() const noexcept {
+        return shards.size();
+    }
+
+    // Sum of the sizes of the shards, each taken under its own lock.
+    std::size_t size() const {
+        std::size_t total = 0;
+        for (auto const &s: shards) {
+            std::shared_lock lock(s->mutex);
+            total += s->viruses.size();
+        }
+        return total;
+    }
+
+    bool exists(virus_id_t const &id) const {
+        auto &home = shard_of(id);
+        std::shared_lock lock(home.mutex);
+        return home.find(id) != nullptr;
+    }
+
+    // Returns ids of parents of given virus.
+    std::vector<virus_id_t> get_parents(virus_id_t const &id) const {
+        auto &home = shard_of(id);
+        std::shared_lock lock(home.mutex);
+        record const *node = home.find(id);
+        if (!node)
+            throw VirusNotFound();
+        return {node->parents.begin(), node->parents.end()};
+    }
+
+    // Returns ids of children of given virus.
+    std::vector<virus_id_t> get_children(virus_id_t const &id) const {
+        auto &home = shard_of(id);
+        std::shared_lock lock(home.mutex);
+        record const *node = home.find(id);
+        if (!node)
+            throw VirusNotFound();
+        return {node->children.begin(), node->children.end()};
+    }
+
+    // Calls f with virus with given id and returns its result. Only the
+    // shard of the virus is locked meanwhile.
+    template<class F>
+    decltype(auto) visit(virus_id_t const &id, F &&f) const {
+        auto &home = shard_of(id);
+        std::shared_lock lock(home.mutex);
+        record const *node = home.find(id);
+        if (!node)
+            throw VirusNotFound();
+        return std::forward<F>(f)(std::as_const(node->virus));
+    }
+
+    // Creates virus with new id with one parent.
+    void create(virus_id_t const &id, virus_id_t const &parent_id) {
+        std::vector<virus_id_t> parents{parent_id};
+        create(id, parents);
+    }
+
+    // Creates virus with new id with many parents. Locks the shard of
+    // the new virus and the shards of its parents.
+    void create(virus_id_t const &id,
+                std::vector<virus_id_t> const &parent_ids) {
+        if (parent_ids.empty())
+            return;
+
+        std::vector<std::size_t> touched{shard_number(id)};
+        for (auto const &parent_id: parent_ids)
+            touched.push_back(shard_number(parent_id));
+        auto locks = lock_shards(std::move(touched));
+
+        auto &home = shard_of(id);
+        if (home.find(id))
+            throw VirusAlreadyCreated();
+        std::vector<record *> parents;
+        for (auto const &parent_id: parent_ids) {
+            record *parent = find(parent_id);
+            if (!parent)
+                throw VirusNotFound();
+            if (std::find(parents.begin(), parents.end(), parent) ==
+                parents.end())
+                parents.push_back(parent);
+        }
+
+        record *node = home.make(id);
+        try {
+            node->parents.reserve(parents.size());
+            for (auto *parent: parents) {
+                make_room(parent->children);
+                node->parents.push_back(parent->virus.get_id());
+            }
+            home.viruses.insert(id, node);
+        } catch (...) {
+            home.destroy(node);
+            throw;
+        }
+
+        // No exceptions can occur from now.
+        for (auto *parent: parents)
+            parent->children.push_back(id);
+    }
+
+    // Adds new edge to genealogy graph.
+    void connect(virus_id_t const &child_id, virus_id_t const &parent_id) {
+        std::vector<virus_id_t> parents{parent_id};
+        connect(child_id, parents);
+    }
+
+    // Adds edges from all given parents. Either all of them are added or,
+    // if one of the viruses doesn't exist, none.
+    void connect(virus_id_t const &child_id,
+                 std::vector<virus_id_t> const &parent_ids) {
+        std::vector<std::size_t> touched{shard_number(child_id)};
+        for (auto const &parent_id: parent_ids)
+            touched.push_back(shard_number(parent_id));
+        auto locks = lock_shards(std::move(touched));
+
+        record *child = find(child_id);
+        if (!child)
+            throw VirusNotFound();
+        std::vector<std::pair<record *, virus_id_t const *>> added;
+        for (auto const &parent_id: parent_ids) {
+            record *parent = find(parent_id);
+            if (!parent)
+                throw VirusNotFound();
+            auto &up = child->parents;
+            bool connected = std::find(up.begin(), up.end(), parent_id) !=
+                             up.end();
+            bool repeated = std::any_of(added.begin(), added.end(),
+                                        [&](auto const &edge) {
+                                            return edge.first == parent;
+                                        });
+            if (!connected && !repeated)
+                added.emplace_back(parent, &parent_id);
+        }
+
+        make_room(child->parents, added.size());
+        for (auto &[parent, parent_id]: added)
+            make_room(parent->children);
+
+        // No exceptions can occur from now.
+        for (auto &[parent, parent_id]: added) {
+            child->parents.push_back(*parent_id);
+            parent->children.push_back(child_id);
+        }
+    }
+
+    // Removes the virus and, recursively, all viruses left without
+    // parents. Locks all shards.
+    void remove(virus_id_t const &id) {
+        auto locks = lock_all();
+
+        record *begin_node = find(id);
+        if (!begin_node)
+            throw VirusNotFound();
+        if (begin_node == find(stem_id))
+            throw TriedToRemoveStemVirus();
+
+        // A virus is removed once all its parents are. The stem has
+        // no parents, so it is never reached.
+        std::vector<record *> doomed{begin_node};
+        std::vector<virus_id_t> doomed_ids{id};
+        std::unordered_set<record *> doomed_set{begin_node};
+        std::unordered_map<record *, std::size_t> removed_parents;
+        for (std::size_t i = 0; i < doomed.size(); i++) {
+            for (auto const &child_id: doomed[i]->children) {
+                record *child = find(child_id);
+                if (++removed_parents[child] == child->parents.size() &&
+                    doomed_set.insert(child).second) {
+                    doomed.push_back(child);
+                    doomed_ids.push_back(child_id);
+                }
+            }
+        }
+
+        // No exceptions can occur from now.
+        for (std::size_t i = 0; i < doomed.size(); i++) {
+            for (auto const &parent_id: doomed[i]->parents) {
+                record *parent = find(parent_id);
+                if (!doomed_set.contains(parent))
+                    erase_id(parent->children, doomed_ids[i]);
+            }
+            for (auto const &child_id: doomed[i]->children) {
+                record *child = find(child_id);
+                if (!doomed_set.contains(child))
+                    erase_id(child->parents, doomed_ids[i]);
+            }
+        }
+        for (std::size_t i = 0; i < doomed.size(); i++) {
+            auto &home = shard_of(doomed_ids[i]);
+            home.viruses.erase(home.viruses.locate(doomed_ids[i]));
+            home.destroy(doomed[i]);
+        }
+    }
+};
+
+#endif //SHARDED_VIRUS_GENEALOGY_H
@@ -0,0 +1,141 @@
+#include "virus_genealogy.h"
+#include <cassert>
+#include <string>
+#include <vector>
+
+class Virus {
+public:
+    using id_type = std::string;
+
+    Virus(id_type const &_id) : id(_id) {
+    }
+
+    id_type const &get_id() const {
+        return id;
+    }
+
+private:
+    id_type id;
+};
+
+class IntVirus {
+public:
+    using id_type = int;
+
+    IntVirus(id_type _id) : id(_id) {
+    }
+
+    id_type get_id() const {
+        return id;
+    }
+
+private:
+    id_type id;
+};
+
+template<class Genealogy>
+void test_batch() {
+    Genealogy gen("A1H1");
+    gen.create("A", "A1H1");
+    gen.create("B", "A1H1");
+    gen.create("C", "A");
+
+    // All operations of a committed batch take effect.
+    auto batch = gen.batch();
+    batch.create("D", "A");
+    batch.connect("D", "B");
+    batch.remove("C");
+    assert(batch.size() == 3);
+    batch.commit();
+    assert(batch.size() == 0);
+    assert(gen.exists("D"));
+    assert(gen.get_parents("D").size() == 2);
+    assert(!gen.exists("C"));
+
+    // A failed batch leaves the genealogy unchanged.
+    batch.remove("A");
+    batch.create("E", "B");
+    batch.create("F", "X");
+    try {
+        batch.commit();
+        assert(false);
+    } catch (VirusNotFound &) {
+    }
+    assert(gen.exists("A"));
+    assert(gen.exists("D"));
+    assert(!gen.exists("E"));
+    assert(gen.get_parents("D").size() == 2);
+
+    // A virus removed and created again within one batch.
+    auto again = gen.batch();
+    again.remove("B");
+    again.create("B", "A");
+    again.commit();
+    assert(gen.exists("B"));
+    assert(gen.get_parents("B") == std::vector<std::string>{"A"});
+    assert(gen.get_parents("D") == std::vector<std::string>{"A"});
+
+    again.remove("B");
+    again.create("B", "D");
+    again.create("G", "X");
+    try {
+        again.commit();
+        assert(false);
+    } catch (VirusNotFound &) {
+    }
+    assert(gen.exists("B"));
+    assert(gen.get_parents("B") == std::vector<std::string>{"A"});
+    assert(gen.exists("D"));
+    assert(gen.get_stem_id() == "A1H1");
+}
+
+// Integral ids are kept in slots of DirectIndex. A slot of a removed
+// virus stays taken until the batch is committed or rolled back.
+template<class Genealogy>
+void test_integral_batch() {
+    Genealogy gen(0);
+    gen.create(1, 0);
+    gen.create(2, 1);
+
+    auto batch = gen.batch();
+    batch.remove(1);
+    batch.create(1, 0);
+    batch.commit();
+    assert(gen.exists(1));
+    assert(gen.get_parents(1) == std::vector<int>{0});
+    assert(!gen.exists(2));
+
+    gen.create(2, 1);
+    batch.remove(1);
+    batch.create(1, 0);
+    batch.create(3, 7);
+    try {
+        batch.commit();
+        assert(false);
+    } catch (VirusNotFound &) {
+    }
+    assert(gen.exists(1));
+    assert(gen.get_parents(1) == std::vector<int>{0});
+    assert(gen.get_parents(2) == std::vector<int>{1});
+    assert(gen[1].get_id() == 1);
+
+    // The failed batch still holds its operations.
+    auto last = gen.batch();
+    last.remove(1);
+    last.create(1, 0);
+    last.commit();
+    gen.remove(1);
+    assert(!gen.exists(1));
+    assert(gen.get_children_begin(0) == gen.get_children_end(0));
+}
+
+int main() {
+    test_batch<VirusGenealogy<Virus>>();
+    test_batch<VirusGenealogy<Virus, DenseIndexStorage, HashIndex>>();
+    test_batch<VirusGenealogy<Virus, SortedDenseIndexStorage>>();
+    test_batch<VirusGenealogy<Virus, SnapshotStorage, SnapshotHashIndex>>();
+    test_integral_batch<VirusGenealogy<IntVirus>>();
+    test_integral_batch<VirusGenealogy<IntVirus, DenseIndexStorage>>();
+    test_integral_batch<VirusGenealogy<IntVirus, SnapshotStorage>>();
+    return 0;
+}
@@ -0,0 +1,191 @@
+#include "concurrent_virus_genealogy.h"
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class Virus {
+public:
+    using id_type = std::string;
+
+    Virus(id_type const &_id) : id(_id) {
+    }
+
+    id_type const &get_id() const {
+        return id;
+    }
+
+private:
+    id_type id;
+};
+
+template<class Genealogy>
+std::vector<std::string> parents_of(Genealogy const &gen,
+                                    std::string const &id) {
+    std::vector<std::string> ids;
+    for (auto it = gen.get_parents_begin(id);
+         it != gen.get_parents_end(id); ++it)
+        ids.push_back(it->get_id());
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+template<class Genealogy>
+void test_deferred_removal() {
+    // A1H1 -> A -> B -> C, A1H1 -> D, B and D -> E, C -> F.
+    Genealogy gen("A1H1");
+    gen.create("A", "A1H1");
+    gen.create("B", "A");
+    gen.create("C", "B");
+    gen.create("D", "A1H1");
+    gen.create("E", std::vector<std::string>{"B", "D"});
+    gen.create("F", "C");
+
+    gen.remove_deferred("A");
+    assert(gen.reclaim_pending());
+    assert(!gen.exists("A"));
+    assert(!gen.exists("B"));
+    assert(!gen.exists("C"));
+    assert(!gen.exists("F"));
+    assert(gen.exists("D"));
+    assert(gen.exists("E"));
+
+    // Parents which are gone are skipped by every parents query.
+    assert(gen.get_parents("E") == std::vector<std::string>{"D"});
+    assert(parents_of(gen, "E") == std::vector<std::string>{"D"});
+    assert(gen.get_parents_count("E") == 1);
+    std::size_t size = 0;
+    for (auto const &parent: gen.get_parents_view("E")) {
+        assert(parent.get_id() == "D");
+        size++;
+    }
+    assert(size == 1);
+    size = 0;
+    for (auto parent: gen.get_parent_handles(gen.get_handle("E"))) {
+        assert(gen.get_virus(parent).get_id() == "D");
+        size++;
+    }
+    assert(size == 1);
+    std::vector<std::string> ancestors;
+    for (auto const &virus: gen.ancestors("E"))
+        ancestors.push_back(virus.get_id());
+    std::sort(ancestors.begin(), ancestors.end());
+    assert((ancestors == std::vector<std::string>{"A1H1", "D"}));
+
+    // Operations over the whole graph wait for reclaim().
+    try {
+        gen.reachability();
+        assert(false);
+    } catch (std::logic_error &) {
+    }
+    try {
+        gen.for_each_node([](Virus const &) {});
+        assert(false);
+    } catch (std::logic_error &) {
+    }
+    if constexpr (requires { gen.snapshot(); }) {
+        try {
+            gen.snapshot();
+            assert(false);
+        } catch (std::logic_error &) {
+        }
+    }
+
+    // Removed ids can be used again before they are reclaimed, without
+    // reclaiming the rest.
+    gen.create("B", "D");
+    assert(gen.exists("B"));
+    assert(gen.get_parents("B") == std::vector<std::string>{"D"});
+    assert(!gen.exists("C"));
+    assert(!gen.exists("F"));
+    assert(gen.reclaim_pending());
+    gen.create("F", "B");
+    assert(gen.get_parents("F") == std::vector<std::string>{"B"});
+    assert(!gen.exists("C"));
+
+    gen.remove_deferred("E");
+    assert(!gen.exists("E"));
+    while (gen.reclaim(1)) {
+    }
+    assert(!gen.reclaim_pending());
+    assert(gen.get_parents_count("B") == 1);
+    assert(gen.get_parents_count("F") == 1);
+    size = 0;
+    for (auto it = gen.get_children_begin("D");
+         it != gen.get_children_end("D"); ++it) {
+        assert(it->get_id() == "B");
+        size++;
+    }
+    assert(size == 1);
+
+    std::size_t count = 0;
+    gen.for_each_node([&](Virus const &) { count++; }, 1);
+    assert(count == 4);
+    auto reachability = gen.reachability();
+    assert(reachability.is_ancestor("D", "B"));
+    assert(reachability.descendant_count("A1H1") == 3);
+    if constexpr (requires { gen.snapshot(); }) {
+        auto snapshot = gen.snapshot();
+        gen.remove_deferred("B");
+        assert(snapshot->exists("B"));
+        assert(!gen.exists("B"));
+        gen.reclaim();
+        assert(snapshot->get_parents("B") == std::vector<std::string>{"D"});
+        gen.create("B", "D");
+    }
+
+    try {
+        gen.remove_deferred("A1H1");
+        assert(false);
+    } catch (TriedToRemoveStemVirus &) {
+    }
+    try {
+        gen.remove_deferred("A");
+        assert(false);
+    } catch (VirusNotFound &) {
+    }
+    assert(!gen.reclaim_pending());
+}
+
+// The background thread tears down removals made by remove_deferred()
+// and by write() callbacks before anything waiting for it goes on.
+template<class Genealogy>
+void test_concurrent() {
+    Genealogy gen("A1H1");
+    gen.create("A", "A1H1");
+    gen.create("B", "A");
+    gen.create("C", std::vector<std::string>{"A1H1", "B"});
+
+    gen.write([](auto &g) { g.remove_deferred("A"); });
+    assert(!gen.exists("B"));
+    assert(gen.read([](auto const &g) { return g.reclaim_pending(); }) ==
+           false);
+    assert(gen.get_parents("C") == std::vector<std::string>{"A1H1"});
+
+    for (int i = 0; i < 100; i++)
+        gen.create("D" + std::to_string(i), i == 0 ? "C"
+                                                   : "D" + std::to_string(i - 1));
+    gen.remove_deferred("D0");
+    assert(!gen.exists("D99"));
+    std::size_t count = 0;
+    gen.read([&](auto const &g) {
+        g.for_each_node([&](Virus const &) { count++; }, 1);
+    });
+    assert(count == 2);
+    gen.write([](auto &g) { g.create("D0", "C"); });
+    assert(gen.get_parents("D0") == std::vector<std::string>{"C"});
+}
+
+int main() {
+    test_deferred_removal<VirusGenealogy<Virus>>();
+    test_deferred_removal<VirusGenealogy<Virus, DenseIndexStorage>>();
+    test_deferred_removal<VirusGenealogy<Virus, SortedDenseIndexStorage,
+            HashIndex>>();
+    test_deferred_removal<VirusGenealogy<Virus, SnapshotStorage,
+            SnapshotHashIndex>>();
+    test_concurrent<ConcurrentVirusGenealogy<Virus>>();
+    test_concurrent<ConcurrentVirusGenealogy<Virus, SnapshotStorage,
+            SnapshotHashIndex>>();
+    return 0;
+}
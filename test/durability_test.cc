@@ -0,0 +1,141 @@
+#include "durable_virus_genealogy.h"
+#include <cassert>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Virus {
+public:
+    using id_type = std::string;
+
+    Virus(id_type const &_id) : id(_id) {
+    }
+
+    id_type const &get_id() const {
+        return id;
+    }
+
+private:
+    id_type id;
+};
+
+namespace fs = std::filesystem;
+
+std::size_t count_files(fs::path const &dir, std::string const &kind) {
+    std::size_t n = 0;
+    for (auto const &entry: fs::directory_iterator(dir))
+        n += entry.path().filename().string().starts_with(kind + ".");
+    return n;
+}
+
+template<class Genealogy>
+std::size_t size_of(Genealogy const &gen) {
+    return gen.read([](auto const &g) {
+        std::size_t n = 0;
+        g.for_each_node([&](Virus const &) { n++; }, 1);
+        return n;
+    });
+}
+
+// A1H1 -> A -> C, A1H1 -> B -> C, then A removed.
+template<class Genealogy>
+void fill(Genealogy &gen) {
+    gen.create("A", "A1H1");
+    gen.create("B", "A1H1");
+    gen.create("C", "A");
+    gen.connect("C", "B");
+    gen.create("D", "A");
+    gen.remove("A");
+}
+
+template<class Genealogy>
+void check(Genealogy const &gen) {
+    assert(gen.get_stem_id() == "A1H1");
+    assert(!gen.exists("A"));
+    assert(gen.exists("B"));
+    assert(gen.exists("C"));
+    assert(!gen.exists("D"));
+    assert(gen.get_parents("C") == std::vector<std::string>{"B"});
+}
+
+template<class Genealogy>
+void test_durability(fs::path const &dir) {
+    fs::remove_all(dir);
+
+    // Recovered from the log alone.
+    {
+        Genealogy gen(dir, "A1H1");
+        fill(gen);
+    }
+    assert(count_files(dir, "checkpoint") == 0);
+    {
+        Genealogy gen(dir, "A1H1");
+        check(gen);
+
+        // Recovered from a checkpoint and the log after it.
+        gen.checkpoint();
+        gen.create("E", "C");
+    }
+    assert(count_files(dir, "checkpoint") == 1);
+    {
+        Genealogy gen(dir, "A1H1");
+        check(gen);
+        assert(gen.get_parents("E") == std::vector<std::string>{"C"});
+    }
+
+    // A record cut off by a crash is dropped.
+    {
+        std::ofstream log(dir / "log.1", std::ios::binary | std::ios::app);
+        log.write("\x20\x00\x00\x00garbage", 11);
+    }
+    {
+        Genealogy gen(dir, "A1H1");
+        check(gen);
+        assert(size_of(gen) == 4);
+        gen.create("F", "E");
+    }
+    {
+        Genealogy gen(dir, "A1H1");
+        assert(gen.get_parents("F") == std::vector<std::string>{"E"});
+    }
+
+    // Writers filling a small log at once, checkpoints taken on the way.
+    fs::remove_all(dir);
+    {
+        Genealogy gen(dir, "A1H1", 256);
+        std::vector<std::jthread> writers;
+        for (int t = 0; t < 4; t++) {
+            writers.emplace_back([&gen, t] {
+                for (int i = 0; i < 50; i++) {
+                    gen.create(std::to_string(t) + "." + std::to_string(i),
+                               "A1H1");
+                }
+            });
+        }
+    }
+    assert(count_files(dir, "checkpoint") == 1);
+    assert(count_files(dir, "log") == 1);
+    {
+        Genealogy gen(dir, "A1H1", 256);
+        assert(size_of(gen) == 201);
+        assert(gen.exists("3.49"));
+    }
+
+    // The stem has to match.
+    try {
+        Genealogy gen(dir, "B");
+        assert(false);
+    } catch (InvalidGenealogyFile &) {
+    }
+    fs::remove_all(dir);
+}
+
+int main() {
+    auto dir = fs::temp_directory_path() / "virus_genealogy_durability_test";
+    test_durability<DurableVirusGenealogy<Virus>>(dir);
+    test_durability<DurableVirusGenealogy<Virus, SnapshotStorage,
+            SnapshotHashIndex>>(dir);
+    return 0;
+}
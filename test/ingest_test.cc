@@ -0,0 +1,140 @@
+#include "virus_event_ingest.h"
+#include <cassert>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+class Virus {
+public:
+    using id_type = std::string;
+
+    Virus(id_type const &_id) : id(_id) {
+    }
+
+    id_type const &get_id() const {
+        return id;
+    }
+
+private:
+    id_type id;
+};
+
+class IntVirus {
+public:
+    using id_type = int;
+
+    IntVirus(id_type _id) : id(_id) {
+    }
+
+    id_type get_id() const {
+        return id;
+    }
+
+private:
+    id_type id;
+};
+
+void test_buffer() {
+    VirusGenealogy<Virus> gen("A1H1");
+    std::string events =
+            "# comment\n"
+            "create A A1H1\n"
+            "\n"
+            "create B\tA1H1\n"
+            "  create C A B  \n"
+            "connect B A\n"
+            "create D C\n"
+            "remove A\r\n";
+    for (std::size_t threads: {1, 3}) {
+        for (std::size_t chunk: {1, 16, 1 << 20}) {
+            VirusGenealogy<Virus> g("A1H1");
+            assert(ingest(g, events, threads, chunk) == 6);
+            assert(!g.exists("A"));
+            assert(g.get_parents("B") == std::vector<std::string>{"A1H1"});
+            assert(g.get_parents("C") == std::vector<std::string>{"B"});
+            assert(g.get_parents("D") == std::vector<std::string>{"C"});
+        }
+    }
+    assert(ingest(gen, "", 2) == 0);
+}
+
+// Chunks of 20 bytes end after every second line below.
+void test_failing_chunk() {
+    VirusGenealogy<Virus> gen("A1H1");
+    try {
+        ingest(gen, "create A A1H1\n"
+                    "create B A1H1\n"
+                    "create C A\n"
+                    "create D nope\n"
+                    "create E A\n"
+                    "create F A\n", 2, 20);
+        assert(false);
+    } catch (VirusNotFound &) {
+    }
+    assert(gen.exists("A"));
+    assert(gen.exists("B"));
+    assert(!gen.exists("C"));
+    assert(!gen.exists("D"));
+    assert(!gen.exists("E"));
+
+    try {
+        ingest(gen, "create G A1H1\n"
+                    "create H A1H1\n"
+                    "create I A\n"
+                    "rename I J\n", 2, 20);
+        assert(false);
+    } catch (InvalidVirusEvent &) {
+    }
+    assert(gen.exists("H"));
+    assert(!gen.exists("I"));
+
+    VirusGenealogy<IntVirus> numbers(0);
+    try {
+        ingest(numbers, "create 1 0\ncreate 2 x\n", 1, 1);
+        assert(false);
+    } catch (InvalidVirusEvent &) {
+    }
+    assert(numbers.exists(1));
+    assert(!numbers.exists(2));
+}
+
+void test_descriptor() {
+    int fds[2];
+    assert(pipe(fds) == 0);
+    std::string events;
+    for (int i = 1; i <= 1000; i++) {
+        events += "create " + std::to_string(i) + " " +
+                  std::to_string(i / 2) + "\n";
+    }
+    events += "remove 2";
+    std::jthread writer([&] {
+        std::size_t written = 0;
+        while (written < events.size()) {
+            auto n = ::write(fds[1], events.data() + written,
+                             std::min<std::size_t>(events.size() - written,
+                                                   777));
+            assert(n > 0);
+            written += std::size_t(n);
+        }
+        close(fds[1]);
+    });
+
+    VirusGenealogy<IntVirus> gen(0);
+    assert(ingest(gen, fds[0], 3, 100) == 1001);
+    close(fds[0]);
+    assert(gen.exists(1));
+    assert(gen.exists(3));
+    assert(!gen.exists(2));
+    assert(!gen.exists(8));
+    assert(gen.exists(1000));
+    assert(gen.get_parents(999) == std::vector<int>{499});
+}
+
+int main() {
+    test_buffer();
+    test_failing_chunk();
+    test_descriptor();
+    return 0;
+}
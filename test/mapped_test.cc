@@ -0,0 +1,185 @@
+#include "mapped_virus_genealogy.h"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+class Virus {
+public:
+    using id_type = std::string;
+
+    Virus(id_type const &_id) : id(_id) {
+    }
+
+    id_type const &get_id() const {
+        return id;
+    }
+
+private:
+    id_type id;
+};
+
+class IntVirus {
+public:
+    using id_type = int;
+
+    IntVirus(id_type _id) : id(_id) {
+    }
+
+    id_type get_id() const {
+        return id;
+    }
+
+private:
+    id_type id;
+};
+
+namespace fs = std::filesystem;
+
+std::string read(fs::path const &path) {
+    std::ifstream in(path, std::ios::binary);
+    return {std::istreambuf_iterator<char>(in),
+            std::istreambuf_iterator<char>()};
+}
+
+void write(fs::path const &path, std::string const &data) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), std::streamsize(data.size()));
+}
+
+template<class T>
+void put(std::string &data, std::uint64_t position, T value) {
+    std::memcpy(data.data() + position, &value, sizeof(value));
+}
+
+void assert_invalid(fs::path const &path, std::string const &data) {
+    write(path, data);
+    try {
+        load_mmap<Virus>(path.string());
+        assert(false);
+    } catch (InvalidGenealogyFile &) {
+    }
+}
+
+void test_round_trip(fs::path const &path) {
+    VirusGenealogy<Virus> gen("A1H1");
+    gen.create("A", "A1H1");
+    gen.create("B", "A1H1");
+    gen.create("C", std::vector<std::string>{"A", "B"});
+    gen.create("D", "C");
+    save(gen, path.string());
+
+    auto mapped = load_mmap<Virus>(path.string());
+    assert(mapped.get_stem_id() == "A1H1");
+    assert(mapped.size() == 5);
+    assert(mapped.exists("D"));
+    assert(!mapped.exists("E"));
+    assert(mapped["C"].get_id() == "C");
+    auto parents = mapped.get_parents("C");
+    std::sort(parents.begin(), parents.end());
+    assert((parents == std::vector<std::string>{"A", "B"}));
+    std::size_t size = 0;
+    for (auto it = mapped.get_children_begin("C");
+         it != mapped.get_children_end("C"); ++it, ++size)
+        assert(it->get_id() == "D");
+    assert(size == 1);
+    try {
+        mapped.get_parents("E");
+        assert(false);
+    } catch (VirusNotFound &) {
+    }
+
+    // Parents always come before their children.
+    std::vector<std::string> order;
+    mapped.for_each_node([&](std::string const &id,
+                             std::vector<std::string> const &ids) {
+        for (auto const &parent: ids)
+            assert(std::find(order.begin(), order.end(), parent) !=
+                   order.end());
+        order.push_back(id);
+    });
+    assert(order.size() == 5);
+    assert(order.front() == "A1H1");
+
+    VirusGenealogy<IntVirus> numbers(0);
+    numbers.create(7, 0);
+    numbers.create(-3, 7);
+    save(numbers, path.string());
+    auto mapped_numbers = load_mmap<IntVirus>(path.string());
+    assert(mapped_numbers.get_stem_id() == 0);
+    assert(mapped_numbers.get_parents(-3) == std::vector<int>{7});
+}
+
+void test_corrupt(fs::path const &path) {
+    VirusGenealogy<Virus> gen("A1H1");
+    gen.create("A", "A1H1");
+    gen.create("B", "A");
+    save(gen, path.string());
+    auto const good = read(path);
+    genealogy_file::header h;
+    std::memcpy(&h, good.data(), sizeof(h));
+    genealogy_file::layout l(h);
+
+    assert_invalid(path, "");
+    assert_invalid(path, good.substr(0, sizeof(h) - 1));
+    assert_invalid(path, good.substr(0, good.size() - 1));
+
+    auto data = good;
+    data[0] = 'X';
+    assert_invalid(path, data);
+
+    data = good;
+    put(data, offsetof(genealogy_file::header, id_bytes), ~std::uint64_t(0));
+    assert_invalid(path, data);
+
+    data = good;
+    put(data, offsetof(genealogy_file::header, stem), std::uint32_t(3));
+    assert_invalid(path, data);
+
+    // Edges to nodes which don't exist.
+    data = good;
+    put(data, l.children, std::uint32_t(3));
+    assert_invalid(path, data);
+    data = good;
+    put(data, l.parents + 4, std::uint32_t(1000));
+    assert_invalid(path, data);
+
+    // Children which don't mirror parents: A, numbered 0, as its own
+    // child instead of B.
+    data = good;
+    put(data, l.children, std::uint32_t(0));
+    assert_invalid(path, data);
+
+    // Offsets out of order or beyond their sections.
+    data = good;
+    put(data, l.children_offsets + 8, std::uint64_t(3));
+    assert_invalid(path, data);
+    data = good;
+    put(data, l.parents_offsets + 8 * h.nodes, std::uint64_t(3));
+    assert_invalid(path, data);
+    data = good;
+    put(data, l.id_offsets + 8, std::uint64_t(1) << 40);
+    assert_invalid(path, data);
+
+    // Ids which aren't sorted can't be found by binary search.
+    data = good;
+    std::swap(data[l.ids], data[l.ids + h.id_bytes - 1]);
+    assert_invalid(path, data);
+
+    write(path, good);
+    assert(load_mmap<Virus>(path.string()).exists("B"));
+}
+
+int main() {
+    auto path = fs::temp_directory_path() / "virus_genealogy_mapped_test.bin";
+    test_round_trip(path);
+    test_corrupt(path);
+    fs::remove(path);
+    return 0;
+}
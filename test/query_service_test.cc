@@ -0,0 +1,194 @@
+#include "concurrent_virus_genealogy.h"
+#include "virus_query_service.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Virus {
+public:
+    using id_type = std::string;
+
+    Virus(id_type const &_id) : id(_id) {
+    }
+
+    id_type const &get_id() const {
+        return id;
+    }
+
+private:
+    id_type id;
+};
+
+std::vector<std::string> sorted(std::vector<std::string> ids) {
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+template<class Genealogy>
+void test_queries() {
+    // A1H1 -> A -> C, A1H1 -> B -> C -> D.
+    Genealogy gen("A1H1");
+    gen.create("A", "A1H1");
+    gen.create("B", "A1H1");
+    gen.create("C", std::vector<std::string>{"A", "B"});
+    gen.create("D", "C");
+
+    VirusQueryService service(gen, 3, 4);
+    assert(service.exists("A").get());
+    assert(!service.exists("E").get());
+    assert(sorted(service.get_parents("C").get()) ==
+           (std::vector<std::string>{"A", "B"}));
+    auto ancestors = service.get_ancestors("D").get();
+    assert(ancestors.front() == "C");
+    assert(sorted(ancestors) ==
+           (std::vector<std::string>{"A", "A1H1", "B", "C"}));
+    assert(service.get_ancestors("A1H1").get().empty());
+
+    auto missing = service.get_parents("E");
+    try {
+        missing.get();
+        assert(false);
+    } catch (VirusNotFound &) {
+    }
+    try {
+        service.get_ancestors("E").get();
+        assert(false);
+    } catch (VirusNotFound &) {
+    }
+
+    // Many equal queries in flight, then queries after a change.
+    std::vector<std::shared_future<std::vector<std::string>>> futures;
+    for (int i = 0; i < 100; i++)
+        futures.push_back(service.get_parents(i % 2 ? "C" : "D"));
+    for (int i = 0; i < 100; i++) {
+        assert(futures[i].get().size() == (i % 2 ? 2u : 1u));
+    }
+    gen.remove("A");
+    assert(!service.exists("A").get());
+    assert(service.get_parents("C").get() == std::vector<std::string>{"B"});
+
+    // Many threads querying while the genealogy changes.
+    std::vector<std::jthread> clients;
+    for (int t = 0; t < 4; t++) {
+        clients.emplace_back([&service, t] {
+            for (int i = 0; i < 200; i++) {
+                assert(service.exists("B").get());
+                auto ids = service.get_ancestors("D").get();
+                assert(std::find(ids.begin(), ids.end(), "B") != ids.end());
+                service.exists(std::to_string(t * 1000 + i));
+            }
+        });
+    }
+    for (int i = 0; i < 200; i++)
+        gen.create("N" + std::to_string(i), "D");
+    clients.clear();
+    assert(service.get_parents("N199").get() ==
+           std::vector<std::string>{"D"});
+
+    // Queries still queued are answered before the service stops.
+    std::shared_future<bool> last;
+    {
+        VirusQueryService stopping(gen, 1, 1);
+        for (int i = 0; i < 50; i++)
+            last = stopping.exists("N" + std::to_string(i));
+    }
+    assert(last.get());
+}
+
+// Source which lets through a given number of reads, and fails them if
+// told to.
+class GatedSource {
+private:
+    ConcurrentVirusGenealogy<Virus> &genealogy;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::size_t permits = 0;
+    bool failing = false;
+
+public:
+    explicit GatedSource(ConcurrentVirusGenealogy<Virus> &g)
+            : genealogy(g) {}
+
+    std::string const &get_stem_id() const noexcept {
+        return genealogy.get_stem_id();
+    }
+
+    void allow(std::size_t n, bool fail = false) {
+        std::lock_guard lock(mutex);
+        permits = n;
+        failing = fail;
+        changed.notify_all();
+    }
+
+    template<class F>
+    decltype(auto) read(F &&f) {
+        {
+            std::unique_lock lock(mutex);
+            changed.wait(lock, [this] { return permits > 0; });
+            permits--;
+            if (failing)
+                throw std::runtime_error("read failed");
+        }
+        return genealogy.read(std::forward<F>(f));
+    }
+};
+
+void test_source_errors() {
+    ConcurrentVirusGenealogy<Virus> gen("A1H1");
+    gen.create("A", "A1H1");
+    GatedSource source(gen);
+    VirusQueryService service(source, 1, 4);
+
+    // Queries of a failed read get its error, later ones are answered.
+    auto failed = service.get_parents("A");
+    source.allow(1, true);
+    try {
+        failed.get();
+        assert(false);
+    } catch (std::runtime_error &) {
+    }
+    std::vector<std::shared_future<bool>> exists;
+    for (int i = 0; i < 10; i++)
+        exists.push_back(service.exists("A"));
+    source.allow(std::numeric_limits<std::size_t>::max(), true);
+    for (auto &f: exists) {
+        try {
+            f.get();
+            assert(false);
+        } catch (std::runtime_error &) {
+        }
+    }
+
+    // A stream of one kind of queries doesn't hold back other kinds.
+    source.allow(0);
+    exists.clear();
+    for (int i = 0; i < 100; i++)
+        exists.push_back(service.exists(std::to_string(i)));
+    auto parents = service.get_parents("A");
+    source.allow(2);
+    assert(parents.get() == std::vector<std::string>{"A1H1"});
+    std::size_t ready = 0;
+    for (auto &f: exists)
+        ready += f.wait_for(std::chrono::seconds(0)) ==
+                 std::future_status::ready;
+    assert(ready <= 8);
+    source.allow(std::numeric_limits<std::size_t>::max());
+    for (auto &f: exists)
+        assert(!f.get());
+}
+
+int main() {
+    test_queries<ConcurrentVirusGenealogy<Virus>>();
+    test_queries<ConcurrentVirusGenealogy<Virus, SnapshotStorage,
+            SnapshotHashIndex>>();
+    test_source_errors();
+    return 0;
+}
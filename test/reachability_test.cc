@@ -0,0 +1,106 @@
+#include "virus_genealogy.h"
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <vector>
+
+class Virus {
+public:
+    using id_type = std::string;
+
+    Virus(id_type const &_id) : id(_id) {
+    }
+
+    id_type const &get_id() const {
+        return id;
+    }
+
+private:
+    id_type id;
+};
+
+template<class Reachability>
+std::vector<std::string> lca(Reachability &reach, std::string const &a,
+                             std::string const &b) {
+    auto ids = reach.lowest_common_ancestors(a, b);
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+template<class Genealogy>
+void test_reachability() {
+    // A1H1 -> A -> C, A1H1 -> B -> C, A -> D.
+    Genealogy gen("A1H1");
+    gen.create("A", "A1H1");
+    gen.create("B", "A1H1");
+    gen.create("C", std::vector<std::string>{"A", "B"});
+    gen.create("D", "A");
+
+    auto reach = gen.reachability();
+    assert(reach.is_ancestor("A1H1", "C"));
+    assert(reach.is_ancestor("A", "D"));
+    assert(!reach.is_ancestor("B", "D"));
+    assert(!reach.is_ancestor("C", "A"));
+    assert(!reach.is_ancestor("A", "A"));
+    assert(reach.min_depth("A1H1") == 0);
+    assert(reach.min_depth("C") == 2);
+    assert(reach.max_depth("D") == 2);
+    assert(reach.descendant_count("A1H1") == 4);
+    assert(reach.descendant_count("A") == 2);
+    assert(reach.descendant_count("B") == 1);
+    assert(lca(reach, "C", "D") == std::vector<std::string>{"A"});
+    assert(lca(reach, "C", "C") == std::vector<std::string>{"C"});
+    assert(lca(reach, "B", "D") == std::vector<std::string>{"A1H1"});
+
+    // New viruses are answered without rebuilding the labels.
+    gen.create("E", "D");
+    gen.create("F", std::vector<std::string>{"E", "B"});
+    assert(reach.is_ancestor("A", "F"));
+    assert(reach.is_ancestor("B", "F"));
+    assert(reach.is_ancestor("E", "F"));
+    assert(!reach.is_ancestor("C", "F"));
+    assert(!reach.is_ancestor("F", "E"));
+    assert(reach.min_depth("F") == 2);
+    assert(reach.max_depth("F") == 4);
+    assert(reach.descendant_count("A1H1") == 6);
+    assert(reach.descendant_count("A") == 4);
+    assert(reach.descendant_count("E") == 1);
+    assert(reach.descendant_count("F") == 0);
+    assert((lca(reach, "C", "F") == std::vector<std::string>{"A", "B"}));
+
+    // New edges of old viruses change their ancestors.
+    gen.connect("D", "B");
+    assert(reach.is_ancestor("B", "D"));
+    assert(reach.is_ancestor("B", "E"));
+    assert(reach.descendant_count("B") == 4);
+    assert(reach.max_depth("E") == 3);
+    assert((lca(reach, "C", "D") == std::vector<std::string>{"A", "B"}));
+
+    // Removals leaving children of removed viruses behind.
+    gen.remove("A");
+    assert(!gen.exists("A"));
+    assert(reach.is_ancestor("B", "C"));
+    assert(reach.min_depth("D") == 2);
+    assert(reach.descendant_count("A1H1") == 5);
+    assert(reach.descendant_count("B") == 4);
+    assert(lca(reach, "C", "E") == std::vector<std::string>{"B"});
+
+    // Many counts after creates rebuild the index on the way.
+    for (int i = 0; i < 20; i++)
+        gen.create("G" + std::to_string(i), "C");
+    for (int i = 0; i < 20; i++) {
+        assert(reach.descendant_count("A1H1") == 25);
+        assert(reach.descendant_count("C") == 20);
+    }
+    assert(reach.is_ancestor("B", "G7"));
+}
+
+int main() {
+    test_reachability<VirusGenealogy<Virus>>();
+    test_reachability<VirusGenealogy<Virus, DenseIndexStorage>>();
+    test_reachability<VirusGenealogy<Virus, SortedDenseIndexStorage,
+            HashIndex>>();
+    test_reachability<VirusGenealogy<Virus, SnapshotStorage,
+            SnapshotHashIndex>>();
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "virus_genealogy.h"
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+class IntVirus {
+public:
+    using id_type = int;
+
+    IntVirus(id_type _id) : id(_id) {
+    }
+
+    id_type get_id() const {
+        return id;
+    }
+
+private:
+    id_type id;
+};
+
+template<class Genealogy>
+std::size_t edge_bytes(Genealogy const &gen) {
+    return gen.memory_usage().edges;
+}
+
+template<class Storage>
+void test_reserve() {
+    using Genealogy = VirusGenealogy<IntVirus, Storage>;
+
+    // Reserving for a few more viruses of a long chain gives their edge
+    // arrays room for the average of the totals, about one edge.
+    Genealogy chain(0);
+    for (int i = 1; i < 1000; i++)
+        chain.create(i, i - 1);
+    auto before = edge_bytes(chain);
+    chain.reserve(1010, 1009);
+    for (int i = 1000; i < 1010; i++)
+        chain.create(i, i - 1);
+    assert(edge_bytes(chain) - before <= 20 * 4 * sizeof(std::size_t));
+    assert(chain.get_parents(1009) == std::vector<int>{1008});
+
+    // Many edges per virus: each of them gets its edges at once.
+    Genealogy dense(0);
+    dense.reserve(101, 800);
+    for (int i = 1; i <= 10; i++)
+        dense.create(i, 0);
+    for (int i = 11; i <= 100; i++) {
+        std::vector<int> parents;
+        for (int p = 1; p <= 8; p++)
+            parents.push_back((i + p) % 10 + 1);
+        dense.create(i, parents);
+    }
+    assert(dense.get_parents(50).size() == 8);
+    assert(dense.get_parents_count(7) == 1);
+
+    // Once the reserved viruses exist, new edge arrays are sized as usual.
+    before = edge_bytes(dense);
+    dense.create(101, 100);
+    dense.create(102, 101);
+    assert(edge_bytes(dense) - before <= 8 * 4 * sizeof(std::size_t));
+
+    // Edge arrays of one virus sized up front.
+    Genealogy hub(0);
+    hub.create(1, 0);
+    hub.reserve_children(1, 100);
+    hub.reserve_parents(1, 1);
+    before = edge_bytes(hub);
+    for (int i = 2; i < 102; i++)
+        hub.create(i, 1);
+    auto grown = edge_bytes(hub) - before;
+    Genealogy plain(0);
+    plain.create(1, 0);
+    before = edge_bytes(plain);
+    for (int i = 2; i < 102; i++)
+        plain.create(i, 1);
+    assert(grown <= edge_bytes(plain) - before);
+    assert(hub.get_parents(101) == std::vector<int>{1});
+
+    try {
+        hub.reserve_children(1000, 1);
+        assert(false);
+    } catch (VirusNotFound &) {
+    }
+}
+
+int main() {
+    test_reserve<DenseIndexStorage>();
+    test_reserve<SortedDenseIndexStorage>();
+    test_reserve<SnapshotStorage>();
+    return 0;
+}
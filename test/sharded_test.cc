@@ -0,0 +1,135 @@
+#include "sharded_virus_genealogy.h"
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Virus {
+public:
+    using id_type = std::string;
+
+    Virus(id_type const &_id) : id(_id) {
+    }
+
+    id_type const &get_id() const {
+        return id;
+    }
+
+private:
+    id_type id;
+};
+
+class IntVirus {
+public:
+    using id_type = int;
+
+    IntVirus(id_type _id) : id(_id) {
+    }
+
+    id_type get_id() const {
+        return id;
+    }
+
+private:
+    id_type id;
+};
+
+template<class T>
+std::vector<T> sorted(std::vector<T> ids) {
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+void test_strings() {
+    ShardedVirusGenealogy<Virus> gen("A1H1", 4);
+    assert(gen.shard_count() == 4);
+    assert(gen.get_stem_id() == "A1H1");
+
+    // Ids spread over all shards, so most edges cross them.
+    std::vector<std::string> ids;
+    for (int i = 0; i < 32; i++)
+        ids.push_back("V" + std::to_string(i));
+    gen.create(ids[0], "A1H1");
+    for (int i = 1; i < 32; i++)
+        gen.create(ids[i], ids[i / 2]);
+    gen.create("X", std::vector<std::string>{"A1H1", "V3"});
+    gen.connect("V5", "X");
+    assert(gen.size() == 34);
+    assert(sorted(gen.get_parents("V5")) ==
+           (std::vector<std::string>{"V2", "X"}));
+    assert(gen.visit("X", [](Virus const &v) { return v.get_id(); }) == "X");
+
+    try {
+        gen.create("V1", "A1H1");
+        assert(false);
+    } catch (VirusAlreadyCreated &) {
+    }
+    try {
+        gen.connect("V1", "nope");
+        assert(false);
+    } catch (VirusNotFound &) {
+    }
+
+    // Only V5, and so its subtree, has a parent outside of the subtree
+    // of V1.
+    gen.remove("V1");
+    assert(!gen.exists("V1"));
+    assert(!gen.exists("V3"));
+    assert(!gen.exists("V4"));
+    assert(!gen.exists("V2"));
+    assert(!gen.exists("V6"));
+    assert(gen.exists("V5"));
+    assert(gen.exists("V10"));
+    assert(gen.exists("X"));
+    assert(gen.get_parents("V5") == std::vector<std::string>{"X"});
+    assert(gen.get_parents("X") == std::vector<std::string>{"A1H1"});
+    assert(gen.get_children("V0").empty());
+    assert(gen.size() == 10);
+
+    try {
+        gen.remove("A1H1");
+        assert(false);
+    } catch (TriedToRemoveStemVirus &) {
+    }
+    try {
+        gen.remove("V1");
+        assert(false);
+    } catch (VirusNotFound &) {
+    }
+}
+
+// Integral ids, with DirectIndex in every shard.
+template<class Index>
+void test_integers() {
+    ShardedVirusGenealogy<IntVirus, Index> gen(0, 3);
+    std::vector<std::jthread> writers;
+    for (int t = 0; t < 3; t++) {
+        writers.emplace_back([&gen, t] {
+            gen.create(t + 1, 0);
+            for (int i = 1; i < 100; i++)
+                gen.create((t + 1) * 1000 + i, i == 1 ? t + 1
+                                                      : (t + 1) * 1000 + i - 1);
+        });
+    }
+    writers.clear();
+    assert(gen.size() == 301);
+    gen.connect(2050, 1099);
+
+    gen.remove(1);
+    assert(!gen.exists(1));
+    assert(!gen.exists(1099));
+    assert(gen.exists(2050));
+    assert(gen.get_parents(2050) == std::vector<int>{2049});
+    gen.remove(2);
+    assert(gen.size() == 101);
+    assert(gen.get_children(0) == std::vector<int>{3});
+}
+
+int main() {
+    test_strings();
+    test_integers<DirectIndex>();
+    test_integers<AutoIndex>();
+    test_integers<HashIndex>();
+    return 0;
+}
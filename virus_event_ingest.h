@@ -0,0 +1,347 @@
+#ifndef VIRUS_EVENT_INGEST_H
+#define VIRUS_EVENT_INGEST_H
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <unistd.h>
+
+#include "virus_genealogy.h"
+
+class InvalidVirusEvent : public std::exception {
+public:
+    const char *what() const noexcept override {
+        return "InvalidVirusEvent";
+    }
+};
+
+// Conversion of ids from text of events. Ids which can be made from
+// strings and arithmetic ids are supported, other ones need
+// a specialization with the same member.
+template<class Virus>
+struct VirusIdParser {
+    using id_type = typename Virus::id_type;
+
+    static id_type parse(std::string_view token) {
+        if constexpr (std::is_constructible_v<id_type, std::string_view>) {
+            return id_type(token);
+        } else {
+            static_assert(std::is_arithmetic_v<id_type>,
+                          "VirusIdParser has to be specialized");
+            id_type id{};
+            auto end = token.data() + token.size();
+            auto [ptr, error] = std::from_chars(token.data(), end, id);
+            if (error != std::errc() || ptr != end)
+                throw InvalidVirusEvent();
+            return id;
+        }
+    }
+};
+
+// Streaming ingest of events, one per line:
+//     create <id> <parent id>...
+//     connect <child id> <parent id>...
+//     remove <id>
+// Tokens are separated by spaces or tabs, empty lines and lines starting
+// with '#' are skipped.
+//
+// The input is cut at line boundaries into chunks of about given size,
+// which worker threads read and parse in parallel, a few chunks ahead of
+// the calling thread. The calling thread applies parsed chunks in order,
+// each as one Batch, so parsing overlaps with changing the graph.
+namespace virus_event_ingest {
+    // Chunks of a buffer which stays valid during the ingest.
+    class buffer_source {
+    private:
+        std::string_view rest;
+
+    public:
+        explicit buffer_source(std::string_view text) : rest(text) {}
+
+        bool read(std::string &chunk, std::size_t size) {
+            if (rest.empty())
+                return false;
+            auto end = rest.find('\n', std::min(size, rest.size()) - 1);
+            end = end == std::string_view::npos ? rest.size() : end + 1;
+            chunk.assign(rest.substr(0, end));
+            rest.remove_prefix(end);
+            return true;
+        }
+    };
+
+    // Chunks read from a file descriptor, which is not closed.
+    class fd_source {
+    private:
+        int fd;
+        bool done = false;
+        // Beginning of the next chunk, read together with the last one.
+        std::string carry;
+
+    public:
+        explicit fd_source(int descriptor) : fd(descriptor) {}
+
+        bool read(std::string &chunk, std::size_t size) {
+            static constexpr std::size_t block = 1 << 16;
+            chunk.swap(carry);
+            carry.clear();
+            auto line_end = chunk.rfind('\n');
+            while (!done &&
+                   (chunk.size() < size || line_end == std::string::npos)) {
+                auto old = chunk.size();
+                chunk.resize(old + block);
+                ssize_t n;
+                do {
+                    n = ::read(fd, chunk.data() + old, block);
+                } while (n < 0 && errno == EINTR);
+                if (n < 0)
+                    throw std::system_error(errno, std::generic_category(),
+                                            "read");
+                chunk.resize(old + std::size_t(n));
+                done = n == 0;
+                auto found = chunk.find('\n', old);
+                if (found != std::string::npos)
+                    line_end = chunk.rfind('\n');
+            }
+            if (!done && line_end + 1 < chunk.size()) {
+                carry.assign(chunk, line_end + 1);
+                chunk.resize(line_end + 1);
+            }
+            return !chunk.empty();
+        }
+    };
+
+    template<class Virus>
+    struct event {
+        enum class action {
+            create, connect, remove
+        };
+
+        action type;
+        typename Virus::id_type id;
+        std::vector<typename Virus::id_type> parent_ids;
+    };
+
+    template<class Virus>
+    void parse(std::string_view text, std::vector<event<Virus>> &events) {
+        using parser = VirusIdParser<Virus>;
+        using action = typename event<Virus>::action;
+        std::vector<std::string_view> tokens;
+        while (!text.empty()) {
+            auto end = text.find('\n');
+            auto line = text.substr(0, end);
+            text.remove_prefix(end == std::string_view::npos
+                               ? text.size() : end + 1);
+
+            tokens.clear();
+            while (true) {
+                auto begin = line.find_first_not_of(" \t\r");
+                if (begin == std::string_view::npos)
+                    break;
+                line.remove_prefix(begin);
+                auto size = std::min(line.find_first_of(" \t\r"),
+                                     line.size());
+                tokens.push_back(line.substr(0, size));
+                line.remove_prefix(size);
+            }
+            if (tokens.empty() || tokens[0].starts_with('#'))
+                continue;
+
+            event<Virus> e;
+            if (tokens[0] == "create" && tokens.size() >= 3)
+                e.type = action::create;
+            else if (tokens[0] == "connect" && tokens.size() >= 3)
+                e.type = action::connect;
+            else if (tokens[0] == "remove" && tokens.size() == 2)
+                e.type = action::remove;
+            else
+                throw InvalidVirusEvent();
+            e.id = parser::parse(tokens[1]);
+            for (std::size_t i = 2; i < tokens.size(); i++)
+                e.parent_ids.push_back(parser::parse(tokens[i]));
+            events.push_back(std::move(e));
+        }
+    }
+
+    template<class Virus, class Storage, class Index, class Instrumentation,
+            class Source>
+    std::size_t run(VirusGenealogy<Virus, Storage, Index,
+                            Instrumentation> &genealogy,
+                    Source &source, std::size_t threads,
+                    std::size_t chunk_size) {
+        using action = typename event<Virus>::action;
+        struct parsed {
+            std::vector<event<Virus>> events;
+            std::exception_ptr error;
+        };
+
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        chunk_size = std::max<std::size_t>(chunk_size, 1);
+        std::size_t const ahead = 2 * threads;
+
+        std::mutex mutex;
+        std::condition_variable changed;
+        // Guarded by mutex.
+        std::map<std::size_t, parsed> done;
+        std::size_t next_apply = 0;
+        std::optional<std::size_t> total;
+        bool stop = false;
+
+        // Taken while reading, so chunks are read in order.
+        std::mutex read_mutex;
+        // Guarded by read_mutex.
+        std::size_t next_read = 0;
+        bool eof = false;
+
+        auto work = [&]() noexcept {
+            std::string text;
+            while (true) {
+                parsed p;
+                std::size_t seq;
+                {
+                    std::unique_lock reading(read_mutex);
+                    {
+                        std::unique_lock lock(mutex);
+                        changed.wait(lock, [&] {
+                            return stop || next_read < next_apply + ahead;
+                        });
+                        if (stop)
+                            return;
+                    }
+                    if (eof)
+                        return;
+                    seq = next_read;
+                    bool more = false;
+                    try {
+                        more = source.read(text, chunk_size);
+                    } catch (...) {
+                        p.error = std::current_exception();
+                    }
+                    if (!more) {
+                        eof = true;
+                        std::lock_guard lock(mutex);
+                        total = seq + (p.error ? 1 : 0);
+                        if (p.error)
+                            done.emplace(seq, std::move(p));
+                        changed.notify_all();
+                        return;
+                    }
+                    next_read++;
+                }
+
+                try {
+                    parse<Virus>(text, p.events);
+                } catch (...) {
+                    p.events.clear();
+                    p.error = std::current_exception();
+                }
+                std::lock_guard lock(mutex);
+                done.emplace(seq, std::move(p));
+                changed.notify_all();
+            }
+        };
+
+        // Stops the workers before they are joined, also on exceptions.
+        struct stopper {
+            std::mutex &mutex;
+            std::condition_variable &changed;
+            bool &stop;
+
+            ~stopper() {
+                std::lock_guard lock(mutex);
+                stop = true;
+                changed.notify_all();
+            }
+        };
+
+        std::vector<std::jthread> workers;
+        stopper guard{mutex, changed, stop};
+        try {
+            workers.reserve(threads);
+            for (std::size_t t = 0; t < threads; t++)
+                workers.emplace_back(work);
+        } catch (...) {
+            if (workers.empty())
+                throw;
+        }
+
+        std::size_t applied = 0;
+        for (std::size_t seq = 0;; seq++) {
+            parsed p;
+            {
+                std::unique_lock lock(mutex);
+                changed.wait(lock, [&] {
+                    return done.contains(seq) || (total && seq >= *total);
+                });
+                auto it = done.find(seq);
+                if (it == done.end())
+                    break;
+                p = std::move(it->second);
+                done.erase(it);
+                next_apply = seq + 1;
+                changed.notify_all();
+            }
+            if (p.error)
+                std::rethrow_exception(p.error);
+
+            auto batch = genealogy.batch();
+            for (auto const &e: p.events) {
+                switch (e.type) {
+                    case action::create:
+                        batch.create(e.id, e.parent_ids);
+                        break;
+                    case action::connect:
+                        for (auto const &parent: e.parent_ids)
+                            batch.connect(e.id, parent);
+                        break;
+                    case action::remove:
+                        batch.remove(e.id);
+                        break;
+                }
+            }
+            batch.commit();
+            applied += p.events.size();
+        }
+        return applied;
+    }
+}
+
+// Applies events read from a file descriptor until its end and returns
+// the number of applied events. Chunks are parsed by given number of
+// threads, by default one per hardware thread, and every chunk is applied
+// as one batch. If reading, parsing or applying a chunk fails, the chunks
+// before it stay applied, the failing one is not applied at all, and
+// the exception is rethrown.
+template<class Virus, class Storage, class Index, class Instrumentation>
+std::size_t ingest(VirusGenealogy<Virus, Storage, Index,
+                           Instrumentation> &genealogy, int fd,
+                   std::size_t threads = 0,
+                   std::size_t chunk_size = 1 << 20) {
+    virus_event_ingest::fd_source source(fd);
+    return virus_event_ingest::run(genealogy, source, threads, chunk_size);
+}
+
+// Same as above, for events in a buffer.
+template<class Virus, class Storage, class Index, class Instrumentation>
+std::size_t ingest(VirusGenealogy<Virus, Storage, Index,
+                           Instrumentation> &genealogy,
+                   std::string_view events, std::size_t threads = 0,
+                   std::size_t chunk_size = 1 << 20) {
+    virus_event_ingest::buffer_source source(events);
+    return virus_event_ingest::run(genealogy, source, threads, chunk_size);
+}
+
+#endif //VIRUS_EVENT_INGEST_H
@@ -11,7 +11,7 @@ public:
     Virus(id_type const &_id) : id(_id) {
     }
 
-    id_type get_id() const {
+    id_type const &get_id() const {
         return id;
     }
 
@@ -1,11 +1,32 @@
 #ifndef VIRUS_GENEALOGY_H
 #define VIRUS_GENEALOGY_H
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <concepts>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <memory_resource>
 #include <map>
+#include <optional>
 #include <set>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <variant>
 #include <vector>
-#include <queue>
+#include <ranges>
+#include <span>
 
 class VirusAlreadyCreated : public std::exception {
 public:
@@ -28,239 +49,3837 @@ public:
     }
 };
 
-template<class Virus>
-class VirusGenealogy {
+// Storage policy keeping every virus in a separately allocated node owned
+// by shared pointers, with edges stored as sets of such pointers.
+// Meta is per-node data of the genealogy, kept next to the virus;
+// it may still be incomplete when the storage is instantiated.
+struct SharedNodeStorage {
+    template<class Virus, class Meta>
+    class storage;
+};
+
+// Order of edges in contiguous edge arrays: the order in which edges were
+// added, or increasing node index, which makes membership tests
+// logarithmic.
+enum class EdgeOrder {
+    insertion, sorted
+};
+
+// Storage policy keeping nodes in a paged slab addressed by dense 32-bit
+// indices, with edges stored as arrays of indices kept in given order.
+template<EdgeOrder Order = EdgeOrder::insertion>
+struct BasicDenseIndexStorage {
+    template<class Virus, class Meta>
+    class storage;
+};
+
+using DenseIndexStorage = BasicDenseIndexStorage<>;
+using SortedDenseIndexStorage = BasicDenseIndexStorage<EdgeOrder::sorted>;
+
+// Storage policy keeping nodes like DenseIndexStorage, in chunks which
+// snapshots of the genealogy share. A shared chunk is copied, together with
+// edge arrays of its nodes, before any of its nodes changes. Viruses have
+// to be copy constructible.
+struct SnapshotStorage {
+    template<class Virus, class Meta>
+    class storage;
+};
+
+template<class Virus, class Meta>
+class SharedNodeStorage::storage {
 private:
     class Node;
 
     using virus_id_t = typename Virus::id_type;
     using smart_ptr = std::shared_ptr<Node>;
-    using set_t = std::set<smart_ptr>;
+    using set_t = std::pmr::set<smart_ptr>;
+
+    // Subclass responsible for gathering all information about virus
+    // and its connections in virus graph.
+    class Node {
+    public:
+        Virus virus;
+        set_t parents, children;
+        Meta meta;
+
+        template<class... Args>
+        explicit Node(std::pmr::memory_resource *resource, Args &&... args)
+                : virus(std::forward<Args>(args)...),
+                  parents(resource), children(resource) {};
+    };
+
+    // Nodes and edge sets may come from different resources.
+    std::pmr::memory_resource *resource;
+    std::pmr::memory_resource *edge_resource;
+
+public:
+    using handle = smart_ptr;
+
+    // Basic bidirectional iterator implementation, used for both edge
+    // directions.
+    class children_iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = Virus;
+        using pointer = const value_type *;
+        using reference = const value_type &;
+
+    private:
+        typename set_t::const_iterator ptr;
+
+    public:
+        children_iterator() {};
+
+        explicit children_iterator(typename set_t::const_iterator p)
+                : ptr(p) {};
+
+        reference operator*() const {
+            return (*ptr)->virus;
+        }
+
+        pointer operator->() const {
+            return &((*ptr)->virus);
+        }
+
+        children_iterator &operator++() {
+            ++ptr;
+            return *this;
+        }
+
+        children_iterator operator++(int) {
+            children_iterator res(*this);
+            operator++();
+            return res;
+        }
+
+        children_iterator &operator--() {
+            --ptr;
+            return *this;
+        }
+
+        children_iterator operator--(int) {
+            children_iterator res(*this);
+            operator--();
+            return res;
+        }
+
+        friend bool operator==(children_iterator const &a,
+                               children_iterator const &b) {
+            return a.ptr == b.ptr;
+        }
+
+        friend bool operator!=(children_iterator const &a,
+                               children_iterator const &b) {
+            return !(a == b);
+        }
+    };
+
+    storage(std::pmr::memory_resource *nodes,
+            std::pmr::memory_resource *edges)
+            : resource(nodes), edge_resource(edges) {}
+
+    // Nodes are owned by their handles, so there is nothing else to swap.
+    void swap(storage &other) noexcept {
+        std::swap(resource, other.resource);
+        std::swap(edge_resource, other.edge_resource);
+    }
+
+    // Set of nodes used by traversals.
+    class visited_set {
+    private:
+        std::unordered_set<Node const *> nodes;
+
+    public:
+        // Returns false if the node already was in the set.
+        bool insert(handle const &node) {
+            return nodes.insert(node.get()).second;
+        }
+
+        void erase(handle const &node) noexcept {
+            nodes.erase(node.get());
+        }
+    };
+
+    // Map from nodes to values, used by indices built over the graph.
+    template<class T>
+    class node_map {
+    private:
+        std::unordered_map<Node const *, T> values;
+
+    public:
+        T &operator[](handle const &node) {
+            return values[node.get()];
+        }
+
+        // The node must be in the map.
+        T const &at(handle const &node) const {
+            return values.find(node.get())->second;
+        }
+    };
+
+    // Node and its control block come from a single allocation.
+    // The virus is constructed from given arguments.
+    template<class... Args>
+    handle make_node(Args &&... args) {
+        return std::allocate_shared<Node>(
+                std::pmr::polymorphic_allocator<Node>(resource),
+                edge_resource, std::forward<Args>(args)...);
+    }
+
+    // Breaks the parent <-> child pointer cycles so that the node can be
+    // freed once the last outside handle is dropped.
+    void destroy_node(handle const &node) noexcept {
+        node->parents.clear();
+        node->children.clear();
+    }
+
+    Virus &virus(handle const &node) const noexcept {
+        return node->virus;
+    }
+
+    Meta &meta(handle const &node) const noexcept {
+        return node->meta;
+    }
+
+    set_t const &parents(handle const &node) const noexcept {
+        return node->parents;
+    }
+
+    set_t const &children(handle const &node) const noexcept {
+        return node->children;
+    }
+
+    bool has_edge(handle const &parent, handle const &child) const {
+        return parent->children.contains(child);
+    }
+
+    // Inserts both directions of an edge or none of them.
+    void add_edge(handle const &parent, handle const &child) {
+        auto it = parent->children.insert(child).first;
+        try {
+            child->parents.insert(parent);
+        } catch (...) {
+            parent->children.erase(it);
+            throw;
+        }
+    }
+
+    void remove_edge(handle const &parent, handle const &child) noexcept {
+        parent->children.erase(child);
+        child->parents.erase(parent);
+    }
+
+    // One direction of an edge taken out of a set, kept in its tree node
+    // so that putting it back does not allocate.
+    struct detached_edge {
+        set_t *from;
+        typename set_t::node_type entry;
+    };
+
+    // Takes parent out of child's parents, leaving the other direction.
+    detached_edge detach_parent(handle const &child, handle const &parent)
+    noexcept {
+        return {&child->parents, child->parents.extract(parent)};
+    }
+
+    // Takes child out of parent's children, leaving the other direction.
+    detached_edge detach_child(handle const &parent, handle const &child)
+    noexcept {
+        return {&parent->children, parent->children.extract(child)};
+    }
+
+    void reattach(detached_edge &&edge) noexcept {
+        edge.from->insert(std::move(edge.entry));
+    }
+
+    // Erases parent from child's parents only.
+    void unlink_parent(handle const &child, handle const &parent) noexcept {
+        child->parents.erase(parent);
+    }
+
+    // Erases child from parent's children only.
+    void unlink_child(handle const &parent, handle const &child) noexcept {
+        parent->children.erase(child);
+    }
+
+    // Erases the last child from parent's children only.
+    void unlink_last_child(handle const &parent) noexcept {
+        parent->children.erase(std::prev(parent->children.end()));
+    }
+
+    // Sets can't be preallocated.
+    void reserve(std::size_t, std::size_t = 0) {}
+
+    void reserve_parents(handle const &, std::size_t) {}
+
+    void reserve_children(handle const &, std::size_t) {}
+
+    // Connects children[i] with parents[offsets[i]..offsets[i + 1]).
+    // Children are fresh nodes and parents of each child are distinct.
+    // Inserts all edges or none of them.
+    void add_edges(std::span<handle const> children,
+                   std::span<std::size_t const> offsets,
+                   std::span<handle const> parents) {
+        std::size_t i = 0, j = 0;
+        try {
+            for (; i < children.size(); ++i) {
+                for (j = offsets[i]; j < offsets[i + 1]; ++j)
+                    add_edge(parents[j], children[i]);
+            }
+        } catch (...) {
+            // Edges up to parents[j] were inserted.
+            for (std::size_t c = 0; c <= i; ++c) {
+                for (std::size_t k = offsets[c];
+                     k < std::min(offsets[c + 1], j); ++k)
+                    remove_edge(parents[k], children[c]);
+            }
+            throw;
+        }
+    }
+
+    children_iterator children_begin(handle const &node) const {
+        return children_iterator(node->children.cbegin());
+    }
+
+    children_iterator children_end(handle const &node) const {
+        return children_iterator(node->children.cend());
+    }
+
+    children_iterator parents_begin(handle const &node) const {
+        return children_iterator(node->parents.cbegin());
+    }
+
+    children_iterator parents_end(handle const &node) const {
+        return children_iterator(node->parents.cend());
+    }
+};
+
+// Finds a node index in an unordered index array. Blocks of eight are
+// compared without branches, which compilers turn into vector compares.
+template<std::contiguous_iterator It>
+It find_edge(It first, It last, std::uint32_t index) noexcept {
+    auto data = std::to_address(first);
+    std::size_t size = last - first, i = 0;
+    for (; i + 8 <= size; i += 8) {
+        bool found = false;
+        for (std::size_t j = 0; j < 8; j++)
+            found |= data[i + j] == index;
+        if (found)
+            break;
+    }
+    while (i < size && data[i] != index)
+        i++;
+    return first + i;
+}
+
+// Set of node indices kept as a bitset, used by traversals of storages
+// which address nodes by dense indices.
+class IndexSet {
+private:
+    std::vector<std::uint64_t> words;
+
+public:
+    // Returns false if the index already was in the set.
+    bool insert(std::uint32_t index) {
+        std::size_t word = index >> 6;
+        if (word >= words.size())
+            words.resize(std::max(word + 1, 2 * words.size()));
+        std::uint64_t bit = std::uint64_t(1) << (index & 63);
+        if (words[word] & bit)
+            return false;
+        words[word] |= bit;
+        return true;
+    }
+
+    void erase(std::uint32_t index) noexcept {
+        std::size_t word = index >> 6;
+        if (word < words.size())
+            words[word] &= ~(std::uint64_t(1) << (index & 63));
+    }
+};
+
+// Map from node indices to values, used by indices built over the graph
+// of storages which address nodes by dense indices.
+template<class T>
+class IndexMap {
+private:
+    std::vector<T> values;
+
+public:
+    T &operator[](std::uint32_t index) {
+        if (index >= values.size())
+            values.resize(std::max<std::size_t>(index + 1, 2 * values.size()));
+        return values[index];
+    }
+
+    // The index must be in the map.
+    T const &at(std::uint32_t index) const noexcept {
+        return values[index];
+    }
+};
+
+// Random access iterator over an array of node indices of storages
+// which keep edges as such arrays, resolving indices in the owning
+// storage. Used for both edge directions.
+template<class Owner, class Virus>
+class IndexArrayIterator {
+public:
+    using iterator_category = std::random_access_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = Virus;
+    using pointer = const value_type *;
+    using reference = const value_type &;
+
+private:
+    using array_iterator =
+            typename std::pmr::vector<std::uint32_t>::const_iterator;
+
+    Owner const *owner = nullptr;
+    array_iterator ptr;
+
+public:
+    IndexArrayIterator() {};
+
+    IndexArrayIterator(Owner const *o, array_iterator p)
+            : owner(o), ptr(p) {};
+
+    reference operator*() const {
+        return owner->virus(*ptr);
+    }
+
+    pointer operator->() const {
+        return &owner->virus(*ptr);
+    }
+
+    reference operator[](difference_type n) const {
+        return owner->virus(ptr[n]);
+    }
+
+    IndexArrayIterator &operator++() {
+        ++ptr;
+        return *this;
+    }
+
+    IndexArrayIterator operator++(int) {
+        IndexArrayIterator res(*this);
+        operator++();
+        return res;
+    }
+
+    IndexArrayIterator &operator--() {
+        --ptr;
+        return *this;
+    }
+
+    IndexArrayIterator operator--(int) {
+        IndexArrayIterator res(*this);
+        operator--();
+        return res;
+    }
+
+    IndexArrayIterator &operator+=(difference_type n) {
+        ptr += n;
+        return *this;
+    }
+
+    IndexArrayIterator &operator-=(difference_type n) {
+        ptr -= n;
+        return *this;
+    }
+
+    friend IndexArrayIterator operator+(IndexArrayIterator it,
+                                        difference_type n) {
+        return it += n;
+    }
+
+    friend IndexArrayIterator operator+(difference_type n,
+                                        IndexArrayIterator it) {
+        return it += n;
+    }
+
+    friend IndexArrayIterator operator-(IndexArrayIterator it,
+                                        difference_type n) {
+        return it -= n;
+    }
+
+    friend difference_type operator-(IndexArrayIterator const &a,
+                                     IndexArrayIterator const &b) {
+        return a.ptr - b.ptr;
+    }
+
+    friend bool operator==(IndexArrayIterator const &a,
+                           IndexArrayIterator const &b) {
+        return a.ptr == b.ptr;
+    }
+
+    friend auto operator<=>(IndexArrayIterator const &a,
+                            IndexArrayIterator const &b) {
+        return a.ptr <=> b.ptr;
+    }
+};
+
+template<EdgeOrder Order>
+template<class Virus, class Meta>
+class BasicDenseIndexStorage<Order>::storage {
+public:
+    using handle = std::uint32_t;
+
+private:
+    using virus_id_t = typename Virus::id_type;
+    using edge_list = std::pmr::vector<handle>;
+
+    static constexpr handle no_slot = std::numeric_limits<handle>::max();
+
+    // Slots are allocated in pages so that growing the slab never moves
+    // viruses which were already handed out by reference.
+    static constexpr std::size_t page_bits = 10;
+    static constexpr std::size_t page_size = std::size_t(1) << page_bits;
+
+    struct Slot {
+        std::optional<Virus> virus;
+        edge_list parents, children;
+        Meta meta;
+        // Next element of the free list, valid only for empty slots.
+        handle next_free = no_slot;
+
+        explicit Slot(std::pmr::memory_resource *resource)
+                : parents(resource), children(resource) {}
+    };
+
+    // Pages of slots and edge arrays may come from different resources.
+    std::pmr::memory_resource *resource;
+    std::pmr::memory_resource *edge_resource;
+    std::pmr::vector<Slot *> pages;
+    handle used_slots = 0;
+    handle free_head = no_slot, free_slots = 0;
+    // Capacity given to an edge array when its first edge is added, until
+    // the nodes reserved by reserve() are made.
+    std::size_t first_capacity = 0, first_budget = 0;
+
+    void make_first_room(edge_list &list) {
+        if (list.capacity() == 0)
+            list.reserve(first_capacity);
+    }
+
+    void spend_first_budget() noexcept {
+        if (first_budget > 0 && --first_budget == 0)
+            first_capacity = 0;
+    }
+
+    // Makes sure that n more edges can be added without allocating.
+    void make_room(edge_list &list, std::size_t n) {
+        make_first_room(list);
+        if (list.capacity() - list.size() < n)
+            list.reserve(std::max(list.size() + n, 2 * list.capacity()));
+    }
+
+    void add_page() {
+        std::pmr::polymorphic_allocator<Slot> alloc(resource);
+        pages.reserve(pages.size() + 1);
+        Slot *page = alloc.allocate(page_size);
+        for (std::size_t i = 0; i < page_size; ++i)
+            std::construct_at(page + i, edge_resource);
+        pages.push_back(page);
+    }
+
+    Slot &slot(handle index) const noexcept {
+        return pages[index >> page_bits][index & (page_size - 1)];
+    }
+
+    static constexpr bool sorted = Order == EdgeOrder::sorted;
+
+    // Position of index in the list, in sorted order also the position
+    // where it should be inserted.
+    static auto find_index(edge_list const &list, handle index) noexcept {
+        if constexpr (sorted)
+            return std::lower_bound(list.begin(), list.end(), index);
+        else
+            return find_edge(list.begin(), list.end(), index);
+    }
+
+    static bool contains_index(edge_list const &list, handle index) noexcept {
+        auto it = find_index(list, index);
+        return it != list.end() && *it == index;
+    }
+
+    static auto insert_index(edge_list &list, handle index) {
+        if constexpr (sorted)
+            return list.insert(find_index(list, index), index);
+        else
+            return list.insert(list.end(), index);
+    }
+
+    static void erase_index(edge_list &list, handle index) noexcept {
+        list.erase(find_index(list, index));
+    }
+
+    static auto detach(edge_list &list, handle owner, handle other,
+                       bool from_parents) noexcept {
+        auto it = find_index(list, other);
+        auto position = std::uint32_t(it - list.begin());
+        list.erase(it);
+        return detached_edge{owner, other, position, from_parents};
+    }
+
+public:
+    storage(std::pmr::memory_resource *nodes,
+            std::pmr::memory_resource *edges)
+            : resource(nodes), edge_resource(edges), pages(nodes) {}
+
+    storage(storage const &) = delete;
+
+    storage &operator=(storage const &) = delete;
+
+    ~storage() noexcept {
+        std::pmr::polymorphic_allocator<Slot> alloc(resource);
+        for (Slot *page: pages) {
+            std::destroy_n(page, page_size);
+            alloc.deallocate(page, page_size);
+        }
+    }
+
+    // Other has to use the same memory resources.
+    void swap(storage &other) noexcept {
+        pages.swap(other.pages);
+        std::swap(used_slots, other.used_slots);
+        std::swap(free_head, other.free_head);
+        std::swap(free_slots, other.free_slots);
+        std::swap(first_capacity, other.first_capacity);
+        std::swap(first_budget, other.first_budget);
+    }
+
+    using children_iterator = IndexArrayIterator<storage, Virus>;
+    using visited_set = IndexSet;
+    template<class T>
+    using node_map = IndexMap<T>;
+
+    // Reuses a free slot if there is one, otherwise appends a new one
+    // (and a new page if the last one is full). The virus is constructed
+    // from given arguments.
+    template<class... Args>
+    handle make_node(Args &&... args) {
+        if (free_head != no_slot) {
+            handle index = free_head;
+            Slot &s = slot(index);
+            s.virus.emplace(std::forward<Args>(args)...);
+            s.meta = Meta();
+            free_head = s.next_free;
+            free_slots--;
+            spend_first_budget();
+            return index;
+        }
+
+        if (used_slots == no_slot)
+            throw std::length_error("DenseIndexStorage is full");
+
+        if ((used_slots >> page_bits) == pages.size())
+            add_page();
+
+        slot(used_slots).virus.emplace(std::forward<Args>(args)...);
+        spend_first_budget();
+        return used_slots++;
+    }
+
+    // Frees the virus and edge arrays and puts the slot on the free list.
+    void destroy_node(handle index) noexcept {
+        Slot &s = slot(index);
+        s.virus.reset();
+        s.parents = edge_list(edge_resource);
+        s.children = edge_list(edge_resource);
+        s.next_free = free_head;
+        free_head = index;
+        free_slots++;
+    }
+
+    Virus &virus(handle index) const noexcept {
+        return *slot(index).virus;
+    }
+
+    Meta &meta(handle index) const noexcept {
+        return slot(index).meta;
+    }
+
+    edge_list const &parents(handle index) const noexcept {
+        return slot(index).parents;
+    }
+
+    edge_list const &children(handle index) const noexcept {
+        return slot(index).children;
+    }
+
+    // Searches the shorter of the two adjacency arrays.
+    bool has_edge(handle parent, handle child) const noexcept {
+        auto const &down = slot(parent).children;
+        auto const &up = slot(child).parents;
+        if (down.size() <= up.size())
+            return contains_index(down, child);
+        return contains_index(up, parent);
+    }
+
+    // Inserts both directions of an edge or none of them.
+    void add_edge(handle parent, handle child) {
+        auto &down = slot(parent).children;
+        make_first_room(down);
+        make_first_room(slot(child).parents);
+        auto it = insert_index(down, child);
+        try {
+            insert_index(slot(child).parents, parent);
+        } catch (...) {
+            down.erase(it);
+            throw;
+        }
+    }
+
+    // Connects child with given parents, which may repeat or be connected
+    // already, and returns the number of added edges. Parents are sorted
+    // and merged into the child's array in one pass, after all arrays got
+    // their room, so either all edges are added or none.
+    std::size_t add_parents(handle child, std::vector<handle> &parents)
+    requires sorted {
+        auto &up = slot(child).parents;
+        std::sort(parents.begin(), parents.end());
+        parents.erase(std::unique(parents.begin(), parents.end()),
+                      parents.end());
+        std::erase_if(parents, [&](handle parent) {
+            return std::binary_search(up.begin(), up.end(), parent);
+        });
+        if (parents.empty())
+            return 0;
+
+        make_room(up, parents.size());
+        for (auto parent: parents)
+            make_room(slot(parent).children, 1);
+
+        // No exceptions can occur from now.
+        for (auto parent: parents)
+            insert_index(slot(parent).children, child);
+        // Merges from the back, so every edge moves at most once.
+        std::size_t i = up.size(), j = parents.size();
+        up.resize(i + j);
+        for (std::size_t out = i + j; j > 0;) {
+            if (i > 0 && up[i - 1] > parents[j - 1])
+                up[--out] = up[--i];
+            else
+                up[--out] = parents[--j];
+        }
+        return parents.size();
+    }
+
+    void remove_edge(handle parent, handle child) noexcept {
+        erase_index(slot(parent).children, child);
+        erase_index(slot(child).parents, parent);
+    }
+
+    // One direction of an edge erased from an edge array. Arrays never
+    // shrink, so putting it back at its position does not allocate
+    // as long as later changes to the array were undone before.
+    struct detached_edge {
+        handle owner, other;
+        std::uint32_t position;
+        bool from_parents;
+    };
+
+    // Takes parent out of child's parents, leaving the other direction.
+    detached_edge detach_parent(handle child, handle parent) noexcept {
+        return detach(slot(child).parents, child, parent, true);
+    }
+
+    // Takes child out of parent's children, leaving the other direction.
+    detached_edge detach_child(handle parent, handle child) noexcept {
+        return detach(slot(parent).children, parent, child, false);
+    }
+
+    void reattach(detached_edge &&edge) noexcept {
+        Slot &s = slot(edge.owner);
+        auto &list = edge.from_parents ? s.parents : s.children;
+        list.insert(list.begin() + edge.position, edge.other);
+    }
+
+    // Erases parent from child's parents only.
+    void unlink_parent(handle child, handle parent) noexcept {
+        erase_index(slot(child).parents, parent);
+    }
+
+    // Erases child from parent's children only.
+    void unlink_child(handle parent, handle child) noexcept {
+        erase_index(slot(parent).children, child);
+    }
+
+    // Erases the last child from parent's children only.
+    void unlink_last_child(handle parent) noexcept {
+        slot(parent).children.pop_back();
+    }
+
+    // Makes room for given number of new nodes. Until they are made, edge
+    // arrays get room for per_node edges when their first edge is added.
+    void reserve(std::size_t nodes, std::size_t per_node = 0) {
+        std::size_t needed = used_slots;
+        if (nodes > free_slots)
+            needed += nodes - free_slots;
+        if (needed > no_slot)
+            throw std::length_error("DenseIndexStorage is full");
+        pages.reserve((needed + page_size - 1) >> page_bits);
+        while ((pages.size() << page_bits) < needed)
+            add_page();
+        first_capacity = nodes > 0 ? per_node : 0;
+        first_budget = nodes;
+    }
+
+    void reserve_parents(handle index, std::size_t n) {
+        slot(index).parents.reserve(n);
+    }
+
+    void reserve_children(handle index, std::size_t n) {
+        slot(index).children.reserve(n);
+    }
+
+    // Connects children[i] with parents[offsets[i]..offsets[i + 1]).
+    // Children are fresh nodes and parents of each child are distinct.
+    // Every edge array is grown to its final size once, after that
+    // edges are appended without any allocation.
+    void add_edges(std::span<handle const> children,
+                   std::span<std::size_t const> offsets,
+                   std::span<handle const> parents) {
+        std::vector<handle> sorted_parents(parents.begin(), parents.end());
+        std::sort(sorted_parents.begin(), sorted_parents.end());
+        for (auto it = sorted_parents.begin(); it != sorted_parents.end();) {
+            auto run = std::upper_bound(it, sorted_parents.end(), *it);
+            auto &down = slot(*it).children;
+            down.reserve(down.size() + (run - it));
+            it = run;
+        }
+        for (std::size_t i = 0; i < children.size(); ++i)
+            slot(children[i]).parents.reserve(offsets[i + 1] - offsets[i]);
+
+        // No exceptions can occur from now.
+        for (std::size_t i = 0; i < children.size(); ++i) {
+            auto &up = slot(children[i]).parents;
+            for (std::size_t j = offsets[i]; j < offsets[i + 1]; ++j) {
+                up.push_back(parents[j]);
+                slot(parents[j]).children.push_back(children[i]);
+            }
+        }
+
+        if constexpr (sorted) {
+            for (auto it = sorted_parents.begin(); it != sorted_parents.end();
+                 it = std::upper_bound(it, sorted_parents.end(), *it)) {
+                auto &down = slot(*it).children;
+                std::sort(down.begin(), down.end());
+            }
+            for (auto child: children) {
+                auto &up = slot(child).parents;
+                std::sort(up.begin(), up.end());
+            }
+        }
+    }
+
+    children_iterator children_begin(handle index) const {
+        return children_iterator(this, slot(index).children.cbegin());
+    }
+
+    children_iterator children_end(handle index) const {
+        return children_iterator(this, slot(index).children.cend());
+    }
+
+    children_iterator parents_begin(handle index) const {
+        return children_iterator(this, slot(index).parents.cbegin());
+    }
+
+    children_iterator parents_end(handle index) const {
+        return children_iterator(this, slot(index).parents.cend());
+    }
+};
+
+// Vector made of fixed size chunks which copies of the vector share.
+// A shared chunk is copied before any of its elements is changed, so
+// copying the whole vector costs one pointer per chunk. Indexing only
+// reads, changes go through edit(). Elements never move while their
+// chunk is not shared.
+template<class T>
+class CowVector {
+private:
+    static constexpr std::size_t chunk_bits = 6;
+    static constexpr std::size_t chunk_size = std::size_t(1) << chunk_bits;
+
+    struct Chunk {
+        // Number of vectors referring to the chunk. References are only
+        // added by copying the vector which owns the chunk, so a chunk
+        // with a single reference can't become shared while it's changed.
+        std::atomic<std::size_t> refs{1};
+        std::pmr::vector<T> items;
+
+        explicit Chunk(std::pmr::memory_resource *resource)
+                : items(resource) {
+            items.reserve(chunk_size);
+        }
+    };
+
+    std::pmr::vector<Chunk *> chunks;
+    std::size_t count = 0;
+
+    std::pmr::polymorphic_allocator<Chunk> chunk_allocator() const noexcept {
+        return chunks.get_allocator().resource();
+    }
+
+    Chunk *new_chunk() {
+        return chunk_allocator().template new_object<Chunk>(
+                chunks.get_allocator().resource());
+    }
+
+    void release(Chunk *chunk) noexcept {
+        if (chunk->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            chunk_allocator().delete_object(chunk);
+    }
+
+    Chunk *unshare(std::size_t k) {
+        Chunk *chunk = chunks[k];
+        if (chunk->refs.load(std::memory_order_acquire) == 1)
+            return chunk;
+
+        Chunk *copy = new_chunk();
+        try {
+            for (auto const &item: chunk->items)
+                copy->items.push_back(item);
+        } catch (...) {
+            chunk_allocator().delete_object(copy);
+            throw;
+        }
+        chunks[k] = copy;
+        release(chunk);
+        return copy;
+    }
+
+public:
+    explicit CowVector(std::pmr::memory_resource *resource)
+            : chunks(resource) {}
+
+    CowVector(std::size_t n, T const &value,
+              std::pmr::polymorphic_allocator<T> alloc)
+            : chunks(alloc.resource()) {
+        try {
+            chunks.reserve((n + chunk_size - 1) >> chunk_bits);
+            while (count < n)
+                emplace_back(value);
+        } catch (...) {
+            for (Chunk *chunk: chunks)
+                release(chunk);
+            throw;
+        }
+    }
+
+    CowVector(std::size_t n, std::pmr::polymorphic_allocator<T> alloc)
+            : CowVector(n, T(), alloc) {}
+
+    // Shares all chunks with other.
+    CowVector(CowVector const &other)
+            : chunks(other.chunks, other.chunks.get_allocator()),
+              count(other.count) {
+        for (Chunk *chunk: chunks)
+            chunk->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    CowVector &operator=(CowVector const &) = delete;
+
+    ~CowVector() noexcept {
+        for (Chunk *chunk: chunks)
+            release(chunk);
+    }
+
+    std::pmr::polymorphic_allocator<T> get_allocator() const noexcept {
+        return chunks.get_allocator().resource();
+    }
+
+    std::size_t size() const noexcept {
+        return count;
+    }
+
+    bool empty() const noexcept {
+        return count == 0;
+    }
+
+    T const &operator[](std::size_t i) const noexcept {
+        return chunks[i >> chunk_bits]->items[i & (chunk_size - 1)];
+    }
+
+    // Returns the element for changing, copying its chunk first if
+    // it is shared. Never throws if the element was edited since
+    // the vector was last copied.
+    T &edit(std::size_t i) {
+        return unshare(i >> chunk_bits)->items[i & (chunk_size - 1)];
+    }
+
+    template<class... Args>
+    T &emplace_back(Args &&... args) {
+        if ((count & (chunk_size - 1)) != 0) {
+            auto &item = unshare(chunks.size() - 1)->items.emplace_back(
+                    std::forward<Args>(args)...);
+            count++;
+            return item;
+        }
+
+        Chunk *chunk = new_chunk();
+        try {
+            chunk->items.emplace_back(std::forward<Args>(args)...);
+            chunks.push_back(chunk);
+        } catch (...) {
+            chunk_allocator().delete_object(chunk);
+            throw;
+        }
+        count++;
+        return chunk->items.back();
+    }
+
+    // The last element must have been edited since the vector was last
+    // copied.
+    void pop_back() noexcept {
+        Chunk *chunk = chunks.back();
+        chunk->items.pop_back();
+        count--;
+        if (chunk->items.empty()) {
+            chunks.pop_back();
+            release(chunk);
+        }
+    }
+
+    void reserve(std::size_t n) {
+        chunks.reserve((n + chunk_size - 1) >> chunk_bits);
+    }
+
+    void swap(CowVector &other) noexcept {
+        chunks.swap(other.chunks);
+        std::swap(count, other.count);
+    }
+};
+
+template<class Virus, class Meta>
+class SnapshotStorage::storage {
+public:
+    using handle = std::uint32_t;
+
+private:
+    using virus_id_t = typename Virus::id_type;
+    using edge_list = std::pmr::vector<handle>;
+
+    static constexpr handle no_slot = std::numeric_limits<handle>::max();
+
+    struct Slot {
+        std::optional<Virus> virus;
+        edge_list parents, children;
+        Meta meta;
+        // Next element of the free list, valid only for empty slots.
+        handle next_free = no_slot;
+
+        explicit Slot(std::pmr::memory_resource *resource)
+                : parents(resource), children(resource) {}
+
+        // Copies keep using the memory resource of the original.
+        Slot(Slot const &other)
+                : virus(other.virus),
+                  parents(other.parents, other.parents.get_allocator()),
+                  children(other.children, other.children.get_allocator()),
+                  meta(other.meta), next_free(other.next_free) {}
+    };
+
+    // Edge arrays may come from another resource than chunks of slots.
+    std::pmr::memory_resource *edge_resource;
+    CowVector<Slot> slots;
+    handle free_head = no_slot, free_slots = 0;
+    // Capacity given to an edge array when its first edge is added, until
+    // the nodes reserved by reserve() are made.
+    std::size_t first_capacity = 0, first_budget = 0;
+
+    void make_first_room(edge_list &list) {
+        if (list.capacity() == 0)
+            list.reserve(first_capacity);
+    }
+
+    void spend_first_budget() noexcept {
+        if (first_budget > 0 && --first_budget == 0)
+            first_capacity = 0;
+    }
+
+    Slot const &slot(handle index) const noexcept {
+        return slots[index];
+    }
+
+    Slot &edit(handle index) {
+        return slots.edit(index);
+    }
+
+    static void erase_index(edge_list &list, handle index) noexcept {
+        list.erase(find_edge(list.begin(), list.end(), index));
+    }
+
+    static auto detach(edge_list &list, handle owner, handle other,
+                       bool from_parents) noexcept {
+        auto it = find_edge(list.begin(), list.end(), other);
+        auto position = std::uint32_t(it - list.begin());
+        list.erase(it);
+        return detached_edge{owner, other, position, from_parents};
+    }
+
+public:
+    storage(std::pmr::memory_resource *nodes,
+            std::pmr::memory_resource *edges)
+            : edge_resource(edges), slots(nodes) {}
+
+    // Copies share all nodes with the original.
+    storage(storage const &) = default;
+
+    storage &operator=(storage const &) = delete;
+
+    // Other has to use the same memory resources.
+    void swap(storage &other) noexcept {
+        slots.swap(other.slots);
+        std::swap(free_head, other.free_head);
+        std::swap(free_slots, other.free_slots);
+        std::swap(first_capacity, other.first_capacity);
+        std::swap(first_budget, other.first_budget);
+    }
+
+    using children_iterator = IndexArrayIterator<storage, Virus>;
+    using visited_set = IndexSet;
+    template<class T>
+    using node_map = IndexMap<T>;
+
+    // Reuses a free slot if there is one, otherwise appends a new one.
+    // The virus is constructed from given arguments.
+    template<class... Args>
+    handle make_node(Args &&... args) {
+        if (free_head != no_slot) {
+            handle index = free_head;
+            Slot &s = edit(index);
+            s.virus.emplace(std::forward<Args>(args)...);
+            s.meta = Meta();
+            free_head = s.next_free;
+            free_slots--;
+            spend_first_budget();
+            return index;
+        }
+
+        if (slots.size() == no_slot)
+            throw std::length_error("SnapshotStorage is full");
+
+        Slot &s = slots.emplace_back(edge_resource);
+        try {
+            s.virus.emplace(std::forward<Args>(args)...);
+        } catch (...) {
+            slots.pop_back();
+            throw;
+        }
+        spend_first_budget();
+        return handle(slots.size() - 1);
+    }
+
+    // Frees the virus and edge arrays and puts the slot on the free list.
+    void destroy_node(handle index) noexcept {
+        Slot &s = edit(index);
+        s.virus.reset();
+        s.parents = edge_list(edge_resource);
+        s.children = edge_list(edge_resource);
+        s.next_free = free_head;
+        free_head = index;
+        free_slots++;
+    }
+
+    // Copies the chunk of the node if it is shared, so that noexcept
+    // changes of the node and its edges don't have to allocate.
+    void make_writable(handle index) {
+        edit(index);
+    }
+
+    Virus const &virus(handle index) const noexcept {
+        return *slot(index).virus;
+    }
+
+    // Meta is scratch data of the genealogy which snapshots never read,
+    // so it is changed in place even in shared chunks.
+    Meta &meta(handle index) const noexcept {
+        return const_cast<Slot &>(slot(index)).meta;
+    }
+
+    edge_list const &parents(handle index) const noexcept {
+        return slot(index).parents;
+    }
+
+    edge_list const &children(handle index) const noexcept {
+        return slot(index).children;
+    }
+
+    // Scans the shorter of the two adjacency arrays.
+    bool has_edge(handle parent, handle child) const noexcept {
+        auto const &down = slot(parent).children;
+        auto const &up = slot(child).parents;
+        if (down.size() <= up.size())
+            return find_edge(down.begin(), down.end(), child) != down.end();
+        return find_edge(up.begin(), up.end(), parent) != up.end();
+    }
+
+    // Inserts both directions of an edge or none of them.
+    void add_edge(handle parent, handle child) {
+        auto &down = edit(parent).children;
+        make_first_room(down);
+        make_first_room(edit(child).parents);
+        down.push_back(child);
+        try {
+            edit(child).parents.push_back(parent);
+        } catch (...) {
+            down.pop_back();
+            throw;
+        }
+    }
+
+    void remove_edge(handle parent, handle child) noexcept {
+        erase_index(edit(parent).children, child);
+        erase_index(edit(child).parents, parent);
+    }
+
+    // One direction of an edge erased from an edge array. Arrays never
+    // shrink, so putting it back at its position does not allocate
+    // as long as later changes to the array were undone before.
+    struct detached_edge {
+        handle owner, other;
+        std::uint32_t position;
+        bool from_parents;
+    };
+
+    // Takes parent out of child's parents, leaving the other direction.
+    detached_edge detach_parent(handle child, handle parent) noexcept {
+        return detach(edit(child).parents, child, parent, true);
+    }
+
+    // Takes child out of parent's children, leaving the other direction.
+    detached_edge detach_child(handle parent, handle child) noexcept {
+        return detach(edit(parent).children, parent, child, false);
+    }
+
+    void reattach(detached_edge &&edge) noexcept {
+        Slot &s = edit(edge.owner);
+        auto &list = edge.from_parents ? s.parents : s.children;
+        list.insert(list.begin() + edge.position, edge.other);
+    }
+
+    // Erases parent from child's parents only.
+    void unlink_parent(handle child, handle parent) noexcept {
+        erase_index(edit(child).parents, parent);
+    }
+
+    // Erases child from parent's children only.
+    void unlink_child(handle parent, handle child) noexcept {
+        erase_index(edit(parent).children, child);
+    }
+
+    // Erases the last child from parent's children only.
+    void unlink_last_child(handle parent) noexcept {
+        edit(parent).children.pop_back();
+    }
+
+    // Chunks themselves are allocated as nodes are added.
+    // Same as in DenseIndexStorage.
+    void reserve(std::size_t nodes, std::size_t per_node = 0) {
+        std::size_t needed = slots.size();
+        if (nodes > free_slots)
+            needed += nodes - free_slots;
+        if (needed > no_slot)
+            throw std::length_error("SnapshotStorage is full");
+        slots.reserve(needed);
+        first_capacity = nodes > 0 ? per_node : 0;
+        first_budget = nodes;
+    }
+
+    void reserve_parents(handle index, std::size_t n) {
+        edit(index).parents.reserve(n);
+    }
+
+    void reserve_children(handle index, std::size_t n) {
+        edit(index).children.reserve(n);
+    }
+
+    // Connects children[i] with parents[offsets[i]..offsets[i + 1]).
+    // Children are fresh nodes and parents of each child are distinct.
+    // Every edge array is grown to its final size once, after that
+    // edges are appended without any allocation.
+    void add_edges(std::span<handle const> children,
+                   std::span<std::size_t const> offsets,
+                   std::span<handle const> parents) {
+        std::vector<handle> sorted(parents.begin(), parents.end());
+        std::sort(sorted.begin(), sorted.end());
+        for (auto it = sorted.begin(); it != sorted.end();) {
+            auto run = std::upper_bound(it, sorted.end(), *it);
+            auto &down = edit(*it).children;
+            down.reserve(down.size() + (run - it));
+            it = run;
+        }
+        for (std::size_t i = 0; i < children.size(); ++i)
+            edit(children[i]).parents.reserve(offsets[i + 1] - offsets[i]);
+
+        // No exceptions can occur from now.
+        for (std::size_t i = 0; i < children.size(); ++i) {
+            auto &up = edit(children[i]).parents;
+            for (std::size_t j = offsets[i]; j < offsets[i + 1]; ++j) {
+                up.push_back(parents[j]);
+                edit(parents[j]).children.push_back(children[i]);
+            }
+        }
+    }
+
+    children_iterator children_begin(handle index) const {
+        return children_iterator(this, slot(index).children.cbegin());
+    }
+
+    children_iterator children_end(handle index) const {
+        return children_iterator(this, slot(index).children.cend());
+    }
+
+    children_iterator parents_begin(handle index) const {
+        return children_iterator(this, slot(index).parents.cbegin());
+    }
+
+    children_iterator parents_end(handle index) const {
+        return children_iterator(this, slot(index).parents.cend());
+    }
+};
+
+// Hash used by HashIndex. Ids convertible to std::string_view are hashed
+// as views, so that lookups by views or C strings hash the same way
+// as lookups by ids themselves.
+struct IdHash {
+    using is_transparent = void;
+
+    template<class K>
+    std::size_t operator()(K const &key) const noexcept {
+        if constexpr (std::is_convertible_v<K const &, std::string_view>)
+            return std::hash<std::string_view>{}(key);
+        else
+            return std::hash<K>{}(key);
+    }
+};
+
+// Index policy keeping ids in an ordered std::map.
+struct MapIndex {
+    template<class Key, class Value>
+    class index;
+};
+
+// Index policy keeping ids in an open-addressing hash table, with arrays
+// of the table of given vector type.
+template<template<class> class Array>
+struct BasicHashIndex {
+    template<class Key, class Value>
+    class index;
+};
+
+using HashIndex = BasicHashIndex<std::pmr::vector>;
+// Hash table which snapshots of the genealogy share.
+using SnapshotHashIndex = BasicHashIndex<CowVector>;
+
+// Index policy for integral ids, keeping the node of id i at position i of
+// an array, so that lookups neither hash nor compare keys. The array grows
+// only while at least about half of it is used; negative ids and ids
+// too large for that go to a hash table.
+struct DirectIndex {
+    template<class Key, class Value>
+    class index;
+};
+
+// Index policy chosen by the type of ids: DirectIndex for integral
+// ids, MapIndex for other ones.
+struct AutoIndex {
+    template<class Key, class Value>
+    using index = std::conditional_t<std::is_integral_v<Key>,
+            typename DirectIndex::template index<Key, Value>,
+            typename MapIndex::template index<Key, Value>>;
+};
+
+template<class Key, class Value>
+class MapIndex::index {
+private:
+    using map_t = std::pmr::map<Key, Value, std::less<>>;
+    map_t entries;
+
+public:
+    using position = typename map_t::iterator;
+
+    explicit index(std::pmr::memory_resource *resource) : entries(resource) {}
+
+    // Other has to use the same memory resource.
+    void swap(index &other) noexcept {
+        entries.swap(other.entries);
+    }
+
+    // Keys which can be compared with ids without converting them.
+    template<class K>
+    static constexpr bool transparent = requires(Key const &a, K const &b) {
+        { a < b } -> std::convertible_to<bool>;
+        { b < a } -> std::convertible_to<bool>;
+    };
+
+    template<class K>
+    Value const *find(K const &key) const {
+        auto it = entries.find(key);
+        return it == entries.end() ? nullptr : &it->second;
+    }
+
+    template<class K>
+    position locate(K const &key) {
+        return entries.find(key);
+    }
+
+    position insert(Key key, Value const &value) {
+        return entries.emplace(std::move(key), value).first;
+    }
+
+    // Tree nodes can't be preallocated.
+    void reserve(std::size_t) {}
+
+    void erase(position pos) noexcept {
+        entries.erase(pos);
+    }
+
+    // Entry taken out of lookups by extract(), kept until it is restored
+    // or released.
+    using extracted = typename map_t::node_type;
+
+    extracted extract(position pos) noexcept {
+        return entries.extract(pos);
+    }
+
+    // Reinserts the tree node without allocating.
+    void restore(extracted &&entry) noexcept {
+        entries.insert(std::move(entry));
+    }
+
+    void release(extracted &&entry) noexcept {
+        extracted dropped(std::move(entry));
+    }
+
+    template<class F>
+    void for_each(F f) const {
+        for (auto const &[key, value]: entries)
+            f(key, value);
+    }
+
+    std::size_t size() const noexcept {
+        return entries.size();
+    }
+};
+
+template<template<class> class Array>
+template<class Key, class Value>
+class BasicHashIndex<Array>::index {
+private:
+    using slot_t = std::uint32_t;
+
+    // Control bytes of the table: empty and erased slots, otherwise
+    // 0x80 | 7 hash bits used to skip most of the key comparisons.
+    static constexpr std::uint8_t empty = 0;
+    static constexpr std::uint8_t erased = 1;
+    static constexpr std::size_t min_capacity = 16;
+    static constexpr slot_t none = std::numeric_limits<slot_t>::max();
+
+    // Entries live in a separate array and the table only keeps their
+    // positions, so rehashing never moves keys and positions handed out
+    // stay valid until the entry is erased.
+    struct Entry {
+        std::optional<std::pair<Key, Value>> item;
+        // Slot of the table pointing at this entry, none if the entry
+        // is not reachable by lookups.
+        slot_t slot = none;
+        // Next element of the free list, valid only for empty entries.
+        slot_t next_free = none;
+    };
+
+    Array<Entry> entries;
+    Array<std::uint8_t> control;
+    Array<slot_t> table;
+    std::size_t used = 0, tombstones = 0;
+    slot_t free_head = none;
+    // Capacity is a power of two, the home slot is taken from the top bits
+    // of a Fibonacci-multiplied hash.
+    unsigned shift = std::numeric_limits<std::size_t>::digits;
+    [[no_unique_address]] IdHash hasher;
+
+    static constexpr bool copy_on_write =
+            requires(Array<slot_t> &array) { array.edit(0); };
+
+    // Element of an array for changing.
+    template<class T>
+    static T &edit(Array<T> &array, std::size_t i) {
+        if constexpr (copy_on_write)
+            return array.edit(i);
+        else
+            return array[i];
+    }
+
+    std::size_t home(std::size_t hash) const noexcept {
+        return (hash * std::size_t(0x9E3779B97F4A7C15ull)) >> shift;
+    }
+
+    static std::uint8_t tag(std::size_t hash) noexcept {
+        return std::uint8_t(0x80 | (hash & 0x7f));
+    }
+
+    std::size_t mask() const noexcept {
+        return table.size() - 1;
+    }
+
+    template<class K>
+    slot_t probe(K const &key) const {
+        if (table.empty())
+            return none;
+        std::size_t hash = hasher(key);
+        std::uint8_t t = tag(hash);
+        for (std::size_t i = home(hash);; i = (i + 1) & mask()) {
+            if (control[i] == empty)
+                return none;
+            if (control[i] == t && entries[table[i]].item->first == key)
+                return table[i];
+        }
+    }
+
+    // First slot on the probe path which no entry takes.
+    std::size_t free_slot(std::size_t hash) const noexcept {
+        std::size_t i = home(hash);
+        while (control[i] > erased)
+            i = (i + 1) & mask();
+        return i;
+    }
+
+    // Makes the entry reachable. The table always has free slots left,
+    // so this never allocates.
+    void link(slot_t pos) noexcept {
+        std::size_t hash = hasher(entries[pos].item->first);
+        std::size_t i = free_slot(hash);
+        if (control[i] == erased)
+            tombstones--;
+        edit(control, i) = tag(hash);
+        edit(table, i) = pos;
+        edit(entries, pos).slot = slot_t(i);
+    }
+
+    void unlink(slot_t pos) noexcept {
+        edit(control, entries[pos].slot) = erased;
+        edit(entries, pos).slot = none;
+        tombstones++;
+    }
+
+    // Rebuilds the table with given capacity, dropping tombstones
+    // on the way.
+    void rehash(std::size_t capacity) {
+        if constexpr (copy_on_write) {
+            for (std::size_t pos = 0; pos < entries.size(); ++pos)
+                edit(entries, pos);
+        }
+        Array<std::uint8_t> new_control(
+                capacity, empty, control.get_allocator());
+        Array<slot_t> new_table(capacity, table.get_allocator());
+
+        control.swap(new_control);
+        table.swap(new_table);
+        shift = std::numeric_limits<std::size_t>::digits -
+                std::countr_zero(capacity);
+        tombstones = 0;
+        for (std::size_t pos = 0; pos < entries.size(); ++pos) {
+            if (entries[pos].slot != none)
+                link(slot_t(pos));
+        }
+    }
+
+    // Makes sure that the table has room for given number of entries.
+    void grow(std::size_t entries_count) {
+        if ((entries_count + tombstones) * 8 <= table.size() * 7)
+            return;
+        std::size_t capacity = std::max(table.size(), min_capacity);
+        while (entries_count * 8 > capacity * 7)
+            capacity *= 2;
+        rehash(capacity);
+    }
+
+public:
+    using position = slot_t;
+    // Entry taken out of lookups by extract(), kept until it is restored
+    // or released.
+    using extracted = slot_t;
+
+    explicit index(std::pmr::memory_resource *resource)
+            : entries(resource), control(resource), table(resource) {}
+
+    // Other has to use the same memory resource.
+    void swap(index &other) noexcept {
+        entries.swap(other.entries);
+        control.swap(other.control);
+        table.swap(other.table);
+        std::swap(used, other.used);
+        std::swap(tombstones, other.tombstones);
+        std::swap(free_head, other.free_head);
+        std::swap(shift, other.shift);
+    }
+
+    // Keys which hash and compare equal to ids without converting them.
+    template<class K>
+    static constexpr bool transparent =
+            std::is_convertible_v<Key const &, std::string_view> &&
+            std::is_convertible_v<K const &, std::string_view>;
+
+    template<class K>
+    Value const *find(K const &key) const {
+        slot_t pos = probe(key);
+        return pos == none ? nullptr : &entries[pos].item->second;
+    }
+
+    template<class K>
+    position locate(K const &key) const {
+        return probe(key);
+    }
+
+    // Key must not be present in the index.
+    position insert(Key key, Value const &value) {
+        // Extracted entries are counted, so that restoring them never
+        // needs a rehash.
+        grow(used + 1);
+        if constexpr (copy_on_write) {
+            std::size_t i = free_slot(hasher(key));
+            edit(control, i);
+            edit(table, i);
+        }
+
+        slot_t pos = free_head;
+        if (pos == none) {
+            if (entries.size() == none)
+                throw std::length_error("HashIndex is full");
+            auto &entry = entries.emplace_back();
+            pos = slot_t(entries.size() - 1);
+            try {
+                entry.item.emplace(std::move(key), value);
+            } catch (...) {
+                entries.pop_back();
+                throw;
+            }
+        } else {
+            auto &entry = edit(entries, pos);
+            entry.item.emplace(std::move(key), value);
+            free_head = entry.next_free;
+        }
+
+        link(pos);
+        used++;
+        return pos;
+    }
+
+    void reserve(std::size_t entries_count) {
+        grow(entries_count);
+        entries.reserve(entries_count);
+    }
+
+    void erase(position pos) noexcept {
+        unlink(pos);
+        release(pos);
+    }
+
+    extracted extract(position pos) noexcept {
+        unlink(pos);
+        return pos;
+    }
+
+    void restore(extracted pos) noexcept {
+        link(pos);
+    }
+
+    void release(extracted pos) noexcept {
+        auto &entry = edit(entries, pos);
+        entry.item.reset();
+        entry.next_free = free_head;
+        free_head = pos;
+        used--;
+    }
+
+    // Copies shared chunks which erasing, extracting, restoring or
+    // releasing the entry changes, so that none of these allocates.
+    // Restoring takes the first free slot on the probe path, which is at
+    // latest the slot the entry was extracted from.
+    void make_writable(position pos) requires copy_on_write {
+        auto const &entry = edit(entries, pos);
+        std::size_t i = home(hasher(entry.item->first));
+        for (;; i = (i + 1) & mask()) {
+            edit(control, i);
+            edit(table, i);
+            if (i == entry.slot)
+                break;
+        }
+    }
+
+    template<class F>
+    void for_each(F f) const {
+        for (std::size_t pos = 0; pos < entries.size(); ++pos) {
+            auto const &entry = entries[pos];
+            if (entry.slot != none)
+                f(entry.item->first, entry.item->second);
+        }
+    }
+
+    std::size_t size() const noexcept {
+        return used;
+    }
+};
+
+template<class Key, class Value>
+class DirectIndex::index {
+private:
+    static_assert(std::is_integral_v<Key>, "DirectIndex needs integral ids");
+
+    enum class state : std::uint8_t {
+        empty, visible, extracted
+    };
+
+    struct Slot {
+        Value value{};
+        state s = state::empty;
+    };
+
+    using overflow_t = typename HashIndex::template index<Key, Value>;
+
+    // Positions of entries of the hash table have the top bit set.
+    static constexpr std::size_t overflow_bit =
+            std::size_t(1) << (std::numeric_limits<std::size_t>::digits - 1);
+    // Ids below this always fit in the array.
+    static constexpr std::size_t min_direct = 1024;
+
+    std::pmr::vector<Slot> slots;
+    overflow_t overflow;
+    // Visible and extracted entries of the array.
+    std::size_t direct_used = 0;
+
+    template<class K>
+    Slot const *direct(K key) const noexcept {
+        if (!std::in_range<std::size_t>(key) ||
+            std::size_t(key) >= slots.size())
+            return nullptr;
+        return &slots[std::size_t(key)];
+    }
+
+public:
+    using position = std::size_t;
+    using extracted = std::size_t;
+
+    explicit index(std::pmr::memory_resource *resource)
+            : slots(resource), overflow(resource) {}
+
+    // Other has to use the same memory resource.
+    void swap(index &other) noexcept {
+        slots.swap(other.slots);
+        overflow.swap(other.overflow);
+        std::swap(direct_used, other.direct_used);
+    }
+
+    // Other integral types are compared by value.
+    template<class K>
+    static constexpr bool transparent = std::is_integral_v<K>;
+
+    template<class K>
+    Value const *find(K const &key) const {
+        auto slot = direct(key);
+        if (slot != nullptr && slot->s == state::visible)
+            return &slot->value;
+        if (overflow.size() == 0 || !std::in_range<Key>(key))
+            return nullptr;
+        return overflow.find(Key(key));
+    }
+
+    // Key must be present in the index.
+    template<class K>
+    position locate(K const &key) const {
+        auto slot = direct(key);
+        if (slot != nullptr && slot->s == state::visible)
+            return std::size_t(key);
+        return overflow_bit | overflow.locate(Key(key));
+    }
+
+    // Key must not be present in the index. A key whose slot holds an
+    // extracted entry goes to the hash table, so the entry keeps its
+    // value until it is restored or released.
+    position insert(Key const &key, Value const &value) {
+        if (std::in_range<std::size_t>(key)) {
+            auto i = std::size_t(key);
+            if (i >= slots.size() && i < overflow_bit &&
+                i < 2 * direct_used + min_direct) {
+                // Doubles the size, but stays within reserved capacity.
+                auto size = std::max(i + 1, 2 * slots.size());
+                if (i < slots.capacity())
+                    size = std::min(size, slots.capacity());
+                slots.resize(size);
+            }
+            if (i < slots.size() && slots[i].s == state::empty) {
+                slots[i] = {value, state::visible};
+                direct_used++;
+                return i;
+            }
+        }
+        return overflow_bit | overflow.insert(key, value);
+    }
+
+    void reserve(std::size_t entries_count) {
+        slots.reserve(std::min(entries_count, overflow_bit - 1));
+    }
+
+    void erase(position pos) noexcept {
+        if (pos & overflow_bit)
+            overflow.erase(typename overflow_t::position(pos ^ overflow_bit));
+        else
+            release(pos);
+    }
+
+    extracted extract(position pos) noexcept {
+        if (pos & overflow_bit)
+            overflow.extract(typename overflow_t::position(pos ^ overflow_bit));
+        else
+            slots[pos].s = state::extracted;
+        return pos;
+    }
+
+    void restore(extracted pos) noexcept {
+        if (pos & overflow_bit)
+            overflow.restore(typename overflow_t::extracted(pos ^ overflow_bit));
+        else
+            slots[pos].s = state::visible;
+    }
+
+    void release(extracted pos) noexcept {
+        if (pos & overflow_bit) {
+            overflow.release(typename overflow_t::extracted(pos ^ overflow_bit));
+        } else {
+            slots[pos] = {};
+            direct_used--;
+        }
+    }
+
+    template<class F>
+    void for_each(F f) const {
+        for (std::size_t i = 0; i < slots.size(); ++i) {
+            if (slots[i].s == state::visible)
+                f(Key(i), slots[i].value);
+        }
+        overflow.for_each(f);
+    }
+
+    std::size_t size() const noexcept {
+        return direct_used + overflow.size();
+    }
+};
+
+// Counters of a genealogy gathered by CountingInstrumentation.
+struct GenealogyStats {
+    // Operations whose calls and latencies are counted. Lookups are all
+    // lookups of ids, also these made by other operations, and cascade is
+    // finding the nodes which remove() removes.
+    enum operation {
+        lookup, create, connect, remove, cascade, bulk_create, batch_commit,
+        operations
+    };
+
+    // Bucket i counts values in [2^i, 2^(i + 1)), the first one also 0.
+    static constexpr std::size_t buckets = 40;
+    using histogram = std::array<std::uint64_t, buckets>;
+
+    static constexpr std::size_t bucket(std::uint64_t value) noexcept {
+        return std::min<std::size_t>(std::bit_width(value | 1) - 1,
+                                     buckets - 1);
+    }
+
+    struct operation_stats {
+        std::uint64_t calls = 0;
+        // Calls which threw. Changes made by them were rolled back.
+        std::uint64_t failures = 0;
+        std::uint64_t nanoseconds = 0;
+        histogram latency{};
+    };
+
+    std::array<operation_stats, operations> calls{};
+    // Edges added to and removed from the graph.
+    std::uint64_t edges_added = 0;
+    std::uint64_t edges_removed = 0;
+    // Edges followed while looking for nodes to remove.
+    std::uint64_t edges_scanned = 0;
+    std::uint64_t nodes_removed = 0;
+    // Numbers of nodes removed at once by remove() and batches.
+    histogram cascade_sizes{};
+    std::uint64_t largest_cascade = 0;
+};
+
+// Bytes which a genealogy took from its memory resource. Memory which
+// viruses allocate themselves, e.g. for long string ids, is not included.
+struct GenealogyMemoryUsage {
+    // The id index.
+    std::size_t index = 0;
+    // Nodes, including viruses and data which the genealogy keeps in them.
+    std::size_t nodes = 0;
+    // Parent and child edge lists.
+    std::size_t edges = 0;
+
+    std::size_t total() const noexcept {
+        return index + nodes + edges;
+    }
+};
+
+// Instrumentation policy of VirusGenealogy. Its recorder gets told about
+// every operation and everything the operation changed. The default
+// recorder does nothing and takes no space.
+struct NoInstrumentation {
+    class recorder {
+    public:
+        static constexpr bool enabled = false;
+
+        struct scope {
+        };
+
+        scope measure(GenealogyStats::operation) const noexcept {
+            return {};
+        }
+
+        void added_edges(std::size_t) const noexcept {}
+
+        void removed_edges(std::size_t) const noexcept {}
+
+        void scanned_edges(std::size_t) const noexcept {}
+
+        void removed_nodes(std::size_t) const noexcept {}
+    };
+};
+
+// Instrumentation policy counting operations, rollbacks, removed nodes and
+// changed edges, and keeping histograms of latencies, available through
+// stats() of the genealogy. Counters are atomic, so lookups of concurrent
+// readers are counted too.
+struct CountingInstrumentation {
+    class recorder {
+    private:
+        using counter = std::atomic<std::uint64_t>;
+        using histogram = std::array<counter, GenealogyStats::buckets>;
+
+        struct operation_counters {
+            counter calls{0};
+            counter failures{0};
+            counter nanoseconds{0};
+            histogram latency{};
+        };
+
+        std::array<operation_counters, GenealogyStats::operations> calls;
+        counter edges_added{0};
+        counter edges_removed{0};
+        counter edges_scanned{0};
+        counter nodes_removed{0};
+        histogram cascade_sizes{};
+        counter largest_cascade{0};
+
+        static void add(counter &c, std::uint64_t n) noexcept {
+            c.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        static std::uint64_t load(counter const &c) noexcept {
+            return c.load(std::memory_order_relaxed);
+        }
+
+        static GenealogyStats::histogram load(histogram const &h) noexcept {
+            GenealogyStats::histogram values;
+            for (std::size_t i = 0; i < h.size(); i++)
+                values[i] = load(h[i]);
+            return values;
+        }
+
+    public:
+        static constexpr bool enabled = true;
+
+        // Counts an operation when destroyed, as failed if it is destroyed
+        // by an exception.
+        class scope {
+        private:
+            recorder &r;
+            GenealogyStats::operation op;
+            int exceptions;
+            std::chrono::steady_clock::time_point start;
+
+        public:
+            scope(recorder &rec, GenealogyStats::operation o) noexcept
+                    : r(rec), op(o), exceptions(std::uncaught_exceptions()),
+                      start(std::chrono::steady_clock::now()) {}
+
+            scope(scope const &) = delete;
+
+            scope &operator=(scope const &) = delete;
+
+            ~scope() {
+                auto elapsed = std::chrono::duration_cast<
+                        std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start).count();
+                auto ns = static_cast<std::uint64_t>(std::max<decltype(
+                        elapsed)>(elapsed, 0));
+                auto &c = r.calls[op];
+                add(c.calls, 1);
+                if (std::uncaught_exceptions() > exceptions)
+                    add(c.failures, 1);
+                add(c.nanoseconds, ns);
+                add(c.latency[GenealogyStats::bucket(ns)], 1);
+            }
+        };
+
+        recorder() = default;
+
+        recorder(recorder const &) = delete;
+
+        recorder &operator=(recorder const &) = delete;
+
+        scope measure(GenealogyStats::operation op) noexcept {
+            return {*this, op};
+        }
+
+        void added_edges(std::size_t n) noexcept {
+            add(edges_added, n);
+        }
+
+        void removed_edges(std::size_t n) noexcept {
+            add(edges_removed, n);
+        }
+
+        void scanned_edges(std::size_t n) noexcept {
+            add(edges_scanned, n);
+        }
+
+        void removed_nodes(std::size_t n) noexcept {
+            add(nodes_removed, n);
+            add(cascade_sizes[GenealogyStats::bucket(n)], 1);
+            auto largest = load(largest_cascade);
+            while (largest < n && !largest_cascade.compare_exchange_weak(
+                    largest, n, std::memory_order_relaxed)) {}
+        }
+
+        GenealogyStats stats() const noexcept {
+            GenealogyStats result;
+            for (std::size_t i = 0; i < calls.size(); i++) {
+                auto &c = result.calls[i];
+                c.calls = load(calls[i].calls);
+                c.failures = load(calls[i].failures);
+                c.nanoseconds = load(calls[i].nanoseconds);
+                c.latency = load(calls[i].latency);
+            }
+            result.edges_added = load(edges_added);
+            result.edges_removed = load(edges_removed);
+            result.edges_scanned = load(edges_scanned);
+            result.nodes_removed = load(nodes_removed);
+            result.cascade_sizes = load(cascade_sizes);
+            result.largest_cascade = load(largest_cascade);
+            return result;
+        }
+
+        void reset() noexcept {
+            auto zero = [](counter &c) {
+                c.store(0, std::memory_order_relaxed);
+            };
+            for (auto &c: calls) {
+                zero(c.calls);
+                zero(c.failures);
+                zero(c.nanoseconds);
+                std::ranges::for_each(c.latency, zero);
+            }
+            zero(edges_added);
+            zero(edges_removed);
+            zero(edges_scanned);
+            zero(nodes_removed);
+            std::ranges::for_each(cascade_sizes, zero);
+            zero(largest_cascade);
+        }
+    };
+};
+
+// Storage is a policy deciding how nodes and edges are kept in memory,
+// SharedNodeStorage, DenseIndexStorage, SortedDenseIndexStorage and
+// SnapshotStorage are provided. Index is a policy deciding how ids are
+// mapped to nodes, MapIndex, HashIndex, SnapshotHashIndex, DirectIndex and
+// AutoIndex are provided; AutoIndex picks DirectIndex for integral ids.
+// Instrumentation is NoInstrumentation or CountingInstrumentation, which
+// makes stats() available.
+template<class Virus, class Storage = SharedNodeStorage,
+        class Index = AutoIndex, class Instrumentation = NoInstrumentation>
+class VirusGenealogy {
+private:
+    using virus_id_t = typename Virus::id_type;
+
+    struct node_meta;
+
+    using storage_t = typename Storage::template storage<Virus, node_meta>;
+    using handle_t = typename storage_t::handle;
+    using index_t = typename Index::template index<virus_id_t, handle_t>;
+
+    // Data which the genealogy keeps in every node.
+    struct node_meta {
+        // Where the id of the node is in the index. Positions of both
+        // indices stay valid until the entry is erased.
+        typename index_t::position position{};
+        // Scratch counter of remove(), valid only if stamped with
+        // the current epoch, so it never has to be reset. Aligned for
+        // atomic access by parallel_remove().
+        alignas(std::atomic_ref<std::uint64_t>::required_alignment)
+        std::uint64_t epoch = 0;
+        alignas(std::atomic_ref<std::uint32_t>::required_alignment)
+        std::uint32_t counter = 0;
+        // Number of changes of the genealogy when the node was created.
+        std::uint64_t born = 0;
+        // Number of removals when the node was last found to be in the
+        // genealogy, or dead_stamp once it's known to be removed but not
+        // reclaimed yet. Written by const lookups, so accessed atomically.
+        alignas(std::atomic_ref<std::uint64_t>::required_alignment)
+        std::uint64_t alive_at = 0;
+    };
+
+    // Lookup keys other than virus_id_t which the index accepts as they are,
+    // without building a temporary id.
+    template<class K>
+    static constexpr bool heterogeneous =
+            !std::is_same_v<K, virus_id_t> &&
+            index_t::template transparent<K>;
+
+    // Passes allocations to the memory resource of the genealogy, counting
+    // bytes which are currently allocated.
+    class counted_resource : public std::pmr::memory_resource {
+    private:
+        std::pmr::memory_resource *upstream;
+        std::atomic<std::size_t> allocated{0};
+
+        void *do_allocate(std::size_t bytes, std::size_t align) override {
+            void *p = upstream->allocate(bytes, align);
+            allocated.fetch_add(bytes, std::memory_order_relaxed);
+            return p;
+        }
+
+        void do_deallocate(void *p, std::size_t bytes,
+                           std::size_t align) override {
+            upstream->deallocate(p, bytes, align);
+            allocated.fetch_sub(bytes, std::memory_order_relaxed);
+        }
+
+        bool do_is_equal(
+                std::pmr::memory_resource const &other) const noexcept override {
+            return this == &other;
+        }
+
+    public:
+        explicit counted_resource(std::pmr::memory_resource *r)
+                : upstream(r) {}
+
+        std::size_t bytes() const noexcept {
+            return allocated.load(std::memory_order_relaxed);
+        }
+    };
+
+    // Resources of the parts of the genealogy, shared with its snapshots,
+    // which may keep using them after the genealogy is gone.
+    struct memory_accounts {
+        counted_resource index, nodes, edges;
+
+        explicit memory_accounts(std::pmr::memory_resource *r)
+                : index(r), nodes(r), edges(r) {}
+    };
+
+    std::shared_ptr<memory_accounts> accounts;
+    storage_t storage;
+    index_t viruses;
+    handle_t stemNode;
+    // Number of changes so far, telling indices built over the graph
+    // when to rebuild.
+    std::uint64_t changes = 0;
+    // Number of changes which could change ancestors of nodes that
+    // existed before, i.e. new edges of existing nodes, and removals
+    // which leave some children of removed nodes in the graph.
+    std::uint64_t lineage_changes = 0;
+    // Nodes taken out by remove_deferred(), or left without parents since,
+    // whose edges to children aren't torn down yet. No other node lists
+    // them as children, so nodes still in the genealogy never reach them.
+    std::vector<handle_t> graveyard;
+    // Number of removals so far. Stamps of nodes found alive before the last
+    // one are stale.
+    std::uint64_t removals = 0;
+
+    static constexpr std::uint64_t dead_stamp =
+            std::numeric_limits<std::uint64_t>::max();
+
+    using recorder_t = typename Instrumentation::recorder;
+    static constexpr bool instrumented = recorder_t::enabled;
+    // Counts operations; lookups in const functions are counted as well.
+    [[no_unique_address]] mutable recorder_t instruments;
+
+    // Every lookup of an id goes through here. Nodes removed by
+    // remove_deferred() are not found, even before they are reclaimed.
+    template<class K>
+    handle_t const *lookup(K const &id) const {
+        [[maybe_unused]] auto scope =
+                instruments.measure(GenealogyStats::lookup);
+        auto node = viruses.find(id);
+        if (node != nullptr && !graveyard.empty() && !alive(*node))
+            return nullptr;
+        return node;
+    }
+
+    using edge_iterator = decltype(std::declval<storage_t const &>()
+            .parents(std::declval<handle_t const &>()).begin());
+
+    // Whether the node is still in the genealogy, i.e. connected to the stem
+    // through nodes which weren't removed. Searches upwards depth-first for
+    // the stem or a node found to be alive since the last removal. Every
+    // node the search enters is stamped, as alive once one of its parents
+    // is or as dead once all its parents are, so each node is searched at
+    // most once per removal. The graph has no cycles, so a node is never
+    // entered again before it's stamped.
+    bool alive(handle_t const &node) const {
+        if (graveyard.empty())
+            return true;
+        auto stamp = [this](handle_t const &n) {
+            return std::atomic_ref(storage.meta(n).alive_at);
+        };
+        auto known = stamp(node).load(std::memory_order_relaxed);
+        if (known == removals)
+            return true;
+        if (known == dead_stamp)
+            return false;
+
+        struct frame {
+            handle_t node;
+            edge_iterator next, end;
+        };
+        // Lookups run in const functions, possibly on many threads at once,
+        // so every thread keeps its own stack.
+        static thread_local std::vector<frame> stack;
+        auto enter = [&](handle_t const &n) {
+            auto const &parents = storage.parents(n);
+            stack.push_back({n, parents.begin(), parents.end()});
+        };
+
+        stack.clear();
+        enter(node);
+        while (true) {
+            auto &top = stack.back();
+            bool found = top.node == stemNode;
+            for (; !found && top.next != top.end; ++top.next) {
+                known = stamp(*top.next).load(std::memory_order_relaxed);
+                if (known == removals)
+                    found = true;
+                else if (known != dead_stamp)
+                    break;
+            }
+            if (!found && top.next != top.end) {
+                enter(*top.next);
+                continue;
+            }
+
+            // The next parent of the node below is checked again and its
+            // stamp is already there.
+            stamp(top.node).store(found ? removals : dead_stamp,
+                                  std::memory_order_relaxed);
+            stack.pop_back();
+            if (stack.empty())
+                return found;
+        }
+    }
+
+    template<class K>
+    handle_t const &find_node(K const &id) const {
+        auto node = lookup(id);
+        if (node == nullptr)
+            throw VirusNotFound();
+        return *node;
+    }
+
+    // Looks up a key of any type convertible to id, without a conversion
+    // if the index accepts the key as it is.
+    template<class K>
+    handle_t const &find_any(K const &id) const {
+        if constexpr (std::is_same_v<K, virus_id_t> || heterogeneous<K>)
+            return find_node(id);
+        else
+            return find_node(virus_id_t(id));
+    }
+
+    // Same for handles, which need no lookup.
+    template<class K>
+    handle_t const &find_key(K const &key) const {
+        if constexpr (std::is_same_v<K, node_handle>)
+            return key.node;
+        else
+            return find_any(key);
+    }
+
+    std::vector<virus_id_t> parent_ids(handle_t const &node) const {
+        auto const &parents = storage.parents(node);
+        std::vector<virus_id_t> ids;
+        ids.reserve(parents.size());
+        for (auto const &parent: parents) {
+            if (alive(parent))
+                ids.push_back(storage.virus(parent).get_id());
+        }
+
+        return ids;
+    }
+
+    // Storages keeping sorted edge arrays connect a node with many
+    // parents at once.
+    static constexpr bool storage_merges_edges =
+            requires(storage_t &s, handle_t const &h,
+                     std::vector<handle_t> &v) { s.add_parents(h, v); };
+
+    // Connects child with parents given as anything which node_of turns
+    // into nodes. It gathers all changes (inserts to edge lists) and in case
+    // of exception it restores them to the beginning state.
+    template<class R, class F>
+    void link(handle_t const &child, R &&parent_keys, F node_of) {
+        if constexpr (storage_merges_edges) {
+            std::vector<handle_t> parents;
+            if constexpr (std::ranges::sized_range<R>)
+                parents.reserve(std::ranges::size(parent_keys));
+            for (auto &&key: parent_keys)
+                parents.push_back(node_of(key));
+            instruments.added_edges(storage.add_parents(child, parents));
+            return;
+        }
+
+        std::vector<std::pair<handle_t, handle_t>> in_process;
+        try {
+            for (auto &key: parent_keys) {
+                auto const &parent = node_of(key);
+                if (!storage.has_edge(parent, child)) {
+                    make_room(in_process, 1);
+                    storage.add_edge(parent, child);
+                    in_process.emplace_back(parent, child);
+                }
+            }
+        } catch (...) {
+            for (auto &[parent, child]: in_process)
+                storage.remove_edge(parent, child);
+            throw;
+        }
+        instruments.added_edges(in_process.size());
+    }
+
+    // Takes a node which no other node lists as a child out of the index
+    // and queues it for reclaim(). There has to be room in the graveyard
+    // already.
+    void bury(handle_t const &node) noexcept {
+        viruses.erase(storage.meta(node).position);
+        storage.meta(node).alive_at = dead_stamp;
+        graveyard.push_back(node);
+    }
+
+    // Unlinks the node from its parents and buries it, in time
+    // proportional to its number of parents. Its own edges are left for
+    // reclaim(). Either does all of it or, if it throws, nothing. The
+    // handle must not be the one held by the index.
+    void detach(handle_t const &node) {
+        make_room(graveyard, 1);
+        if constexpr (storage_copy_on_write) {
+            storage.make_writable(node);
+            for (auto const &parent: storage.parents(node))
+                storage.make_writable(parent);
+        }
+        if constexpr (index_copy_on_write)
+            viruses.make_writable(storage.meta(node).position);
+
+        // No exceptions can occur from now.
+        for (auto const &parent: storage.parents(node))
+            storage.unlink_child(parent, node);
+        instruments.removed_edges(storage.parents(node).size());
+        bury(node);
+    }
+
+    // Counter value marking nodes which are going to be removed.
+    static constexpr std::uint32_t doomed =
+            std::numeric_limits<std::uint32_t>::max();
+
+    std::uint64_t epoch = 0;
+    // Nodes found by the last cascade(), kept to reuse its memory.
+    std::vector<handle_t> cascade_nodes;
+
+    // Copy-on-write policies share parts of the graph with snapshots and
+    // copy them before changing them.
+    static constexpr bool storage_copy_on_write =
+            requires(storage_t &s, handle_t const &h) { s.make_writable(h); };
+    static constexpr bool index_copy_on_write =
+            requires(index_t &v, typename index_t::position p) {
+                v.make_writable(p);
+            };
+
+    std::uint32_t &counter(handle_t const &node) const noexcept {
+        auto &meta = storage.meta(node);
+        if (meta.epoch != epoch) {
+            meta.epoch = epoch;
+            meta.counter = 0;
+        }
+        return meta.counter;
+    }
+
+    bool is_doomed(handle_t const &node) const noexcept {
+        return counter(node) == doomed;
+    }
+
+    // Finds nodes which should be removed from graph together with
+    // begin_node, i.e. the ones which lose all their parents, in bfs order.
+    // For each node the number of its removed parents is counted in
+    // the node itself, so the only allocation is growing cascade_nodes.
+    void cascade(handle_t const &begin_node) {
+        epoch++;
+        cascade_nodes.clear();
+        cascade_nodes.push_back(begin_node);
+        counter(begin_node) = doomed;
+        [[maybe_unused]] auto scope =
+                instruments.measure(GenealogyStats::cascade);
+        for (std::size_t i = 0; i < cascade_nodes.size(); ++i) {
+            instruments.scanned_edges(
+                    storage.children(cascade_nodes[i]).size());
+            for (auto const &child: storage.children(cascade_nodes[i])) {
+                auto &val = counter(child);
+                val++;
+                // If all parents were already deleted child should be deleted.
+                if (val == storage.parents(child).size()) {
+                    val = doomed;
+                    cascade_nodes.push_back(child);
+                }
+            }
+        }
+    }
+
+    // Epoch stamp of a node whose counter is being reset by another thread.
+    static constexpr std::uint64_t resetting =
+            std::numeric_limits<std::uint64_t>::max();
+
+    // Frontiers and cascades smaller than this are processed by
+    // the calling thread only.
+    static constexpr std::size_t parallel_grain = 1024;
+    // Number of nodes which threads claim at once.
+    static constexpr std::size_t parallel_chunk = 64;
+
+    // Counts one more removed parent of the node and returns the count.
+    // Safe to call from many threads: the first one in the current epoch
+    // resets the counter while the others wait.
+    std::uint32_t count_removed_parent(handle_t const &node) const noexcept {
+        auto &meta = storage.meta(node);
+        std::atomic_ref<std::uint64_t> stamp(meta.epoch);
+        auto seen = stamp.load(std::memory_order_acquire);
+        while (seen != epoch) {
+            if (seen == resetting) {
+                seen = stamp.load(std::memory_order_acquire);
+            } else if (stamp.compare_exchange_weak(
+                    seen, resetting, std::memory_order_acquire)) {
+                meta.counter = 0;
+                stamp.store(epoch, std::memory_order_release);
+                break;
+            }
+        }
+        return std::atomic_ref<std::uint32_t>(meta.counter).fetch_add(
+                1, std::memory_order_relaxed) + 1;
+    }
+
+    // Number of threads used by parallel operations given 0 for default.
+    static std::size_t thread_count(std::size_t threads) noexcept {
+        return threads != 0
+               ? threads
+               : std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Calls f(t) on up to given number of threads, each with a distinct
+    // t < threads, the calling thread being number 0. Threads which fail
+    // to start are skipped, so f has to claim its work dynamically.
+    // Rethrows the first exception thrown by f once all threads finished.
+    template<class F>
+    static void run_parallel(std::size_t threads, F const &f) {
+        std::exception_ptr error;
+        std::atomic_flag failed;
+        auto run = [&](std::size_t t) noexcept {
+            try {
+                f(t);
+            } catch (...) {
+                if (!failed.test_and_set())
+                    error = std::current_exception();
+            }
+        };
+
+        {
+            std::vector<std::jthread> workers;
+            try {
+                workers.reserve(threads - 1);
+                for (std::size_t t = 1; t < threads; t++)
+                    workers.emplace_back(run, t);
+            } catch (...) {
+                // The threads which started share all the work.
+            }
+            run(0);
+        }
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    // Parallel version of cascade(). The search goes level by level:
+    // threads claim chunks of the current frontier and count removed
+    // parents of their children atomically, so that exactly one of them
+    // finds out that a child loses all its parents.
+    void parallel_cascade(handle_t const &begin_node, std::size_t threads) {
+        epoch++;
+        cascade_nodes.clear();
+        cascade_nodes.push_back(begin_node);
+        counter(begin_node) = doomed;
+        [[maybe_unused]] auto scope =
+                instruments.measure(GenealogyStats::cascade);
+
+        std::vector<std::vector<handle_t>> found(threads);
+        for (std::size_t level = 0; level < cascade_nodes.size();) {
+            std::size_t end = cascade_nodes.size();
+            std::atomic<std::size_t> next = level;
+            auto expand = [&](std::size_t t) {
+                for (;;) {
+                    std::size_t i = next.fetch_add(parallel_chunk);
+                    if (i >= end)
+                        break;
+                    for (auto j = i; j < std::min(i + parallel_chunk, end); j++) {
+                        instruments.scanned_edges(
+                                storage.children(cascade_nodes[j]).size());
+                        for (auto const &child:
+                                storage.children(cascade_nodes[j])) {
+                            if (count_removed_parent(child) ==
+                                storage.parents(child).size()) {
+                                std::atomic_ref<std::uint32_t>(
+                                        storage.meta(child).counter).store(
+                                        doomed, std::memory_order_relaxed);
+                                found[t].push_back(child);
+                            }
+                        }
+                    }
+                }
+            };
+
+            if (end - level < parallel_grain)
+                expand(0);
+            else
+                run_parallel(threads, expand);
+            for (auto &nodes: found) {
+                cascade_nodes.insert(cascade_nodes.end(),
+                                     nodes.begin(), nodes.end());
+                nodes.clear();
+            }
+            level = end;
+        }
+    }
+
+    // Numbers of all nodes, in the order of nodes.
+    using numbering = typename storage_t::template node_map<std::uint32_t>;
+
+    // Operations over the whole graph would see nodes which lookups treat
+    // as removed, so they need reclaim() to be finished.
+    void require_reclaimed() const {
+        if (!graveyard.empty())
+            throw std::logic_error("VirusGenealogy: reclaim() is pending");
+    }
+
+    void number_nodes(std::vector<handle_t> &nodes,
+                      numbering &numbers) const {
+        require_reclaimed();
+        nodes.reserve(viruses.size());
+        viruses.for_each([&](auto const &, handle_t const &node) {
+            numbers[node] = std::uint32_t(nodes.size());
+            nodes.push_back(node);
+        });
+    }
+
+    // Calls visit(node, number) for all nodes in topological order, from
+    // the stem down or, if Up, from the leaves up: a node is visited once
+    // all its parents (children if Up) were. Frontiers of ready nodes go
+    // level by level like in parallel_cascade(), threads claiming chunks
+    // of a frontier and counting visited neighbours atomically.
+    template<bool Up, class V>
+    void topological_walk(std::vector<handle_t> const &nodes,
+                          numbering const &numbers, V const &visit,
+                          std::size_t threads) const {
+        auto before = [this](handle_t const &node) -> auto const & {
+            if constexpr (Up)
+                return storage.children(node);
+            else
+                return storage.parents(node);
+        };
+        auto after = [this](handle_t const &node) -> auto const & {
+            if constexpr (Up)
+                return storage.parents(node);
+            else
+                return storage.children(node);
+        };
+
+        std::vector<std::atomic<std::uint32_t>> pending(nodes.size());
+        std::vector<handle_t> frontier;
+        for (std::size_t i = 0; i < nodes.size(); i++) {
+            auto count = std::uint32_t(before(nodes[i]).size());
+            pending[i].store(count, std::memory_order_relaxed);
+            if (count == 0)
+                frontier.push_back(nodes[i]);
+        }
+
+        std::vector<std::vector<handle_t>> found(threads);
+        while (!frontier.empty()) {
+            std::atomic<std::size_t> next = 0;
+            auto expand = [&](std::size_t t) {
+                for (;;) {
+                    std::size_t i = next.fetch_add(parallel_chunk);
+                    if (i >= frontier.size())
+                        break;
+                    auto end = std::min(i + parallel_chunk, frontier.size());
+                    for (auto j = i; j < end; j++) {
+                        auto const &node = frontier[j];
+                        visit(node, numbers.at(node));
+                        for (auto const &other: after(node)) {
+                            if (pending[numbers.at(other)].fetch_sub(
+                                    1, std::memory_order_acq_rel) == 1)
+                                found[t].push_back(other);
+                        }
+                    }
+                }
+            };
+
+            if (frontier.size() < parallel_grain)
+                expand(0);
+            else
+                run_parallel(threads, expand);
+            frontier.clear();
+            for (auto &ready: found) {
+                frontier.insert(frontier.end(), ready.begin(), ready.end());
+                ready.clear();
+            }
+        }
+    }
+
+    template<bool Up, class T, class F>
+    auto reduce(F f, std::size_t threads) const {
+        Reduction<T> result(*this);
+        std::vector<handle_t> nodes;
+        number_nodes(nodes, result.numbers);
+        result.values.resize(nodes.size());
+        auto &values = result.values;
+        auto const &numbers = result.numbers;
+        topological_walk<Up>(
+                nodes, numbers,
+                [&](handle_t const &node, std::uint32_t number) {
+                    auto value = [&](handle_t const &other) -> T const & {
+                        return *values[numbers.at(other)];
+                    };
+                    auto const &others = [&]() -> auto const & {
+                        if constexpr (Up)
+                            return storage.children(node);
+                        else
+                            return storage.parents(node);
+                    }();
+                    values[number].emplace(
+                            f(storage.virus(node),
+                              std::views::transform(others, value)));
+                },
+                thread_count(threads));
+        return result;
+    }
+
+    // Removes nodes found by cascade() from the storage and the index.
+    void destroy_cascade() noexcept {
+        for (auto const &current: cascade_nodes) {
+            auto position = storage.meta(current).position;
+            storage.destroy_node(current);
+            viruses.erase(position);
+        }
+        cascade_nodes.clear();
+    }
+
+    // Makes everything which removing nodes found by cascade() changes
+    // writable, so that copy-on-write policies don't allocate while
+    // the nodes are removed.
+    void make_cascade_writable(handle_t const &begin_node) {
+        for (auto const &current: cascade_nodes) {
+            if constexpr (storage_copy_on_write) {
+                storage.make_writable(current);
+                for (auto const &child: storage.children(current)) {
+                    if (!is_doomed(child))
+                        storage.make_writable(child);
+                }
+            }
+            if constexpr (index_copy_on_write)
+                viruses.make_writable(storage.meta(current).position);
+        }
+        if constexpr (storage_copy_on_write) {
+            for (auto const &parent: storage.parents(begin_node))
+                storage.make_writable(parent);
+        }
+    }
+
+    template<class K>
+    void remove_node(K const &id) {
+        [[maybe_unused]] auto scope =
+                instruments.measure(GenealogyStats::remove);
+        handle_t begin_node = find_key(id);
+        if (begin_node == stemNode)
+            throw TriedToRemoveStemVirus();
+
+        cascade(begin_node);
+        make_cascade_writable(begin_node);
+
+        // No exceptions can occur from now. Only edges which connect
+        // deleted nodes with nodes which stay in graph are erased one
+        // by one, the rest goes away with the deleted nodes.
+        changes++;
+        removals++;
+        instruments.removed_edges(storage.parents(begin_node).size());
+        for (auto const &parent: storage.parents(begin_node))
+            storage.unlink_child(parent, begin_node);
+
+        bool orphans = false;
+        for (auto const &current: cascade_nodes) {
+            for (auto const &child: storage.children(current)) {
+                if (!is_doomed(child)) {
+                    storage.unlink_parent(child, current);
+                    instruments.removed_edges(1);
+                    orphans = true;
+                }
+            }
+        }
+        lineage_changes += orphans;
+        instruments.removed_nodes(cascade_nodes.size());
+        destroy_cascade();
+    }
+
+    // remove_node() with the cascade found, and edges to nodes which stay
+    // in graph unlinked, by many threads. Edges are grouped by the node
+    // which stays, so that every edge list is changed by one thread.
+    // Destroying nodes and erasing them from the index stays sequential,
+    // since both touch structures shared by all nodes.
+    template<class K>
+    void parallel_remove_node(K const &id, std::size_t threads) {
+        [[maybe_unused]] auto scope =
+                instruments.measure(GenealogyStats::remove);
+        handle_t begin_node = find_node(id);
+        if (begin_node == stemNode)
+            throw TriedToRemoveStemVirus();
+
+        threads = thread_count(threads);
+        parallel_cascade(begin_node, threads);
+        make_cascade_writable(begin_node);
+
+        using edge = std::pair<handle_t, handle_t>;
+        bool wide = cascade_nodes.size() >= parallel_grain;
+        std::size_t groups = wide ? threads : 1;
+        // Edges found by thread t whose child is in group g are
+        // in kept[t * groups + g].
+        std::vector<std::vector<edge>> kept(threads * groups);
+        std::atomic<std::size_t> next = 0;
+        auto collect = [&](std::size_t t) {
+            for (;;) {
+                std::size_t i = next.fetch_add(parallel_chunk);
+                if (i >= cascade_nodes.size())
+                    break;
+                auto end = std::min(i + parallel_chunk, cascade_nodes.size());
+                for (auto j = i; j < end; j++) {
+                    auto const &current = cascade_nodes[j];
+                    for (auto const &child: storage.children(current)) {
+                        if (is_doomed(child))
+                            continue;
+                        auto hash = std::hash<handle_t>{}(child) *
+                                    0x9e3779b97f4a7c15u;
+                        kept[t * groups + (hash >> 32) % groups]
+                                .emplace_back(child, current);
+                    }
+                }
+            }
+        };
+        if (wide)
+            run_parallel(threads, collect);
+        else
+            collect(0);
+
+        // No exceptions can occur from now.
+        changes++;
+        removals++;
+        instruments.removed_edges(storage.parents(begin_node).size());
+        for (auto const &parent: storage.parents(begin_node))
+            storage.unlink_child(parent, begin_node);
+
+        bool orphans = false;
+        for (auto const &edges: kept) {
+            orphans |= !edges.empty();
+            instruments.removed_edges(edges.size());
+        }
+        lineage_changes += orphans;
+
+        next = 0;
+        auto unlink = [&](std::size_t) noexcept {
+            for (;;) {
+                std::size_t g = next.fetch_add(1);
+                if (g >= groups)
+                    break;
+                for (std::size_t t = 0; t < threads; t++) {
+                    for (auto const &[child, parent]: kept[t * groups + g])
+                        storage.unlink_parent(child, parent);
+                }
+            }
+        };
+        if (wide)
+            run_parallel(threads, unlink);
+        else
+            unlink(0);
+
+        instruments.removed_nodes(cascade_nodes.size());
+        destroy_cascade();
+    }
+
+    // Changes applied by Batch::commit(). They are undone in reverse order
+    // if one of the operations fails, otherwise the removed nodes are
+    // destroyed once the whole batch is applied.
+    struct created_node {
+        handle_t node;
+        typename index_t::position position;
+    };
+
+    struct added_edge {
+        handle_t parent, child;
+    };
+
+    struct removed_node {
+        handle_t node;
+        typename index_t::extracted entry;
+    };
+
+    using undo_entry = std::variant<created_node, added_edge, removed_node,
+            typename storage_t::detached_edge>;
+
+    // Shared by all batches, so that its memory is reused between commits.
+    std::vector<undo_entry> undo_log;
+
+    // Makes sure that n more elements can be appended without allocating.
+    template<class T>
+    static void make_room(std::vector<T> &v, std::size_t n) {
+        if (v.capacity() - v.size() < n)
+            v.reserve(std::max(v.size() + n, 2 * v.capacity()));
+    }
+
+    void logged_connect(handle_t const &child,
+                        std::vector<virus_id_t> const &parent_ids) {
+        for (auto &id: parent_ids) {
+            auto const &parent = find_node(id);
+            if (!storage.has_edge(parent, child)) {
+                make_room(undo_log, 1);
+                storage.add_edge(parent, child);
+                undo_log.emplace_back(added_edge{parent, child});
+            }
+        }
+    }
+
+    void logged_create(virus_id_t const &id,
+                       std::vector<virus_id_t> const &parent_ids) {
+        if (parent_ids.empty())
+            return;
+
+        if (exists(id))
+            throw VirusAlreadyCreated();
+
+        make_room(undo_log, 1);
+        auto node = storage.make_node(id);
+        try {
+            storage.meta(node).position = viruses.insert(id, node);
+        } catch (...) {
+            storage.destroy_node(node);
+            throw;
+        }
+        undo_log.emplace_back(created_node{node, storage.meta(node).position});
+        storage.meta(node).born = changes;
+
+        logged_connect(node, parent_ids);
+    }
+
+    // Unlike remove_node() it keeps removed nodes intact and only takes
+    // them out of the index and the edge lists of nodes which stay,
+    // so that every change can be reverted without allocating.
+    void logged_remove(virus_id_t const &id) {
+        handle_t begin_node = find_node(id);
+        if (begin_node == stemNode)
+            throw TriedToRemoveStemVirus();
+
+        cascade(begin_node);
+        make_cascade_writable(begin_node);
+
+        std::size_t orphans = 0;
+        for (auto const &current: cascade_nodes) {
+            for (auto const &child: storage.children(current))
+                orphans += !is_doomed(child);
+        }
+        make_room(undo_log, cascade_nodes.size() + orphans +
+                            storage.parents(begin_node).size());
+        lineage_changes += orphans > 0;
+
+        // No exceptions can occur from now.
+        for (auto const &parent: storage.parents(begin_node))
+            undo_log.emplace_back(storage.detach_child(parent, begin_node));
+
+        for (auto const &current: cascade_nodes) {
+            for (auto const &child: storage.children(current)) {
+                if (!is_doomed(child))
+                    undo_log.emplace_back(
+                            storage.detach_parent(child, current));
+            }
+        }
+
+        for (auto const &current: cascade_nodes) {
+            undo_log.emplace_back(removed_node{
+                    current,
+                    viruses.extract(storage.meta(current).position)});
+        }
+        cascade_nodes.clear();
+    }
+
+    void rollback() noexcept {
+        for (auto it = undo_log.rbegin(); it != undo_log.rend(); ++it) {
+            std::visit([this](auto &change) {
+                using change_t = std::decay_t<decltype(change)>;
+                if constexpr (std::is_same_v<change_t, created_node>) {
+                    viruses.erase(change.position);
+                    storage.destroy_node(change.node);
+                } else if constexpr (std::is_same_v<change_t, added_edge>) {
+                    storage.remove_edge(change.parent, change.child);
+                } else if constexpr (std::is_same_v<change_t, removed_node>) {
+                    viruses.restore(std::move(change.entry));
+                } else {
+                    storage.reattach(std::move(change));
+                }
+            }, *it);
+        }
+        undo_log.clear();
+    }
+
+    void finish() noexcept {
+        std::size_t removed_nodes = 0;
+        for (auto &change: undo_log) {
+            if (auto removed = std::get_if<removed_node>(&change)) {
+                storage.destroy_node(removed->node);
+                viruses.release(std::move(removed->entry));
+                removed_nodes++;
+            }
+        }
+        if constexpr (instrumented) {
+            std::size_t added = 0;
+            std::size_t detached = 0;
+            for (auto const &change: undo_log) {
+                added += std::holds_alternative<added_edge>(change);
+                detached += std::holds_alternative<
+                        typename storage_t::detached_edge>(change);
+            }
+            instruments.added_edges(added);
+            instruments.removed_edges(detached);
+            if (removed_nodes > 0)
+                instruments.removed_nodes(removed_nodes);
+        }
+        undo_log.clear();
+    }
+
+    struct share_tag {
+    };
+
+    struct empty_tag {
+    };
+
+    // Empty genealogy without a stem, allocating like other.
+    VirusGenealogy(VirusGenealogy const &other, empty_tag)
+            : accounts(other.accounts),
+              storage(&accounts->nodes, &accounts->edges),
+              viruses(&accounts->index) {}
+
+    // Viruses are moved to the new layout by compact() if they can be
+    // moved back without exceptions, otherwise they are copied.
+    static constexpr bool relocate_viruses =
+            !storage_copy_on_write &&
+            std::is_nothrow_move_constructible_v<Virus> &&
+            std::is_nothrow_move_assignable_v<Virus>;
+
+    // Shares all nodes and ids with other.
+    VirusGenealogy(VirusGenealogy const &other, share_tag)
+            : accounts(other.accounts), storage(other.storage),
+              viruses(other.viruses),
+              stemNode(other.stemNode), changes(other.changes),
+              lineage_changes(other.lineage_changes) {}
+
+public:
+    using children_iterator = typename storage_t::children_iterator;
+
+    // Forward iterator over parents of a virus, which skips parents
+    // removed by remove_deferred() and not reclaimed yet.
+    class parents_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = Virus;
+        using pointer = const value_type *;
+        using reference = const value_type &;
+
+    private:
+        friend class VirusGenealogy;
+
+        VirusGenealogy const *genealogy = nullptr;
+        edge_iterator ptr{}, end{};
+
+        parents_iterator(VirusGenealogy const *g, edge_iterator p,
+                         edge_iterator e)
+                : genealogy(g), ptr(p), end(e) {
+            skip();
+        }
+
+        void skip() {
+            while (ptr != end && !genealogy->alive(*ptr))
+                ++ptr;
+        }
+
+    public:
+        parents_iterator() {};
+
+        reference operator*() const {
+            return genealogy->storage.virus(*ptr);
+        }
+
+        pointer operator->() const {
+            return &operator*();
+        }
+
+        parents_iterator &operator++() {
+            ++ptr;
+            skip();
+            return *this;
+        }
+
+        parents_iterator operator++(int) {
+            parents_iterator res(*this);
+            operator++();
+            return res;
+        }
+
+        friend bool operator==(parents_iterator const &a,
+                               parents_iterator const &b) {
+            return a.ptr == b.ptr;
+        }
+    };
+
+    // Non-owning range of parents, valid until the genealogy changes.
+    using parents_view = std::ranges::subrange<parents_iterator>;
+
+    // Queue of create(), connect() and remove() calls applied together by
+    // commit(), with one rollback log for all of them. Either every queued
+    // operation takes effect or, if one of them throws, the genealogy
+    // is left unchanged and the queue is kept.
+    class Batch {
+    private:
+        enum class action {
+            create, connect, remove
+        };
+
+        struct operation {
+            action type;
+            virus_id_t id;
+            std::vector<virus_id_t> parent_ids;
+        };
+
+        VirusGenealogy *genealogy;
+        std::vector<operation> operations;
+
+    public:
+        explicit Batch(VirusGenealogy &g) : genealogy(&g) {}
+
+        void create(virus_id_t const &id, virus_id_t const &parent_id) {
+            operations.push_back({action::create, id, {parent_id}});
+        }
+
+        void create(virus_id_t const &id,
+                    std::vector<virus_id_t> const &parent_ids) {
+            operations.push_back({action::create, id, parent_ids});
+        }
+
+        void connect(virus_id_t const &child_id,
+                     virus_id_t const &parent_id) {
+            operations.push_back({action::connect, child_id, {parent_id}});
+        }
+
+        void remove(virus_id_t const &id) {
+            operations.push_back({action::remove, id, {}});
+        }
+
+        std::size_t size() const noexcept {
+            return operations.size();
+        }
+
+        // Applies queued operations in order and empties the queue.
+        void commit() {
+            auto &g = *genealogy;
+            [[maybe_unused]] auto scope =
+                    g.instruments.measure(GenealogyStats::batch_commit);
+            g.reclaim();
+            g.changes++;
+            try {
+                for (auto const &op: operations) {
+                    switch (op.type) {
+                        case action::create:
+                            g.logged_create(op.id, op.parent_ids);
+                            break;
+                        case action::connect:
+                            g.lineage_changes++;
+                            g.logged_connect(g.find_node(op.id),
+                                             op.parent_ids);
+                            break;
+                        case action::remove:
+                            g.logged_remove(op.id);
+                            break;
+                    }
+                }
+            } catch (...) {
+                g.rollback();
+                throw;
+            }
+            g.finish();
+            operations.clear();
+        }
+    };
+
+    Batch batch() {
+        return Batch(*this);
+    }
+
+    // Lazy breadth-first range over all ancestors (if Up) or descendants
+    // of a virus, nearest first, each of them visited once. The range
+    // keeps its queue and visited set, restart() reuses them for another
+    // traversal. Valid until the genealogy changes.
+    template<bool Up>
+    class Traversal {
+    private:
+        friend class VirusGenealogy;
+
+        VirusGenealogy const *genealogy;
+        std::vector<handle_t> queue;
+        std::size_t current = 0;
+        typename storage_t::visited_set visited;
+
+        Traversal(VirusGenealogy const &g, handle_t const &start)
+                : genealogy(&g) {
+            expand(start);
+        }
+
+        auto const &neighbours(handle_t const &node) const noexcept {
+            if constexpr (Up)
+                return genealogy->storage.parents(node);
+            else
+                return genealogy->storage.children(node);
+        }
+
+        // Queues neighbours of the node which weren't visited yet, except
+        // parents removed by remove_deferred().
+        void expand(handle_t const &node) {
+            auto const &next = neighbours(node);
+            make_room(queue, next.size());
+            for (auto const &neighbour: next) {
+                if constexpr (Up) {
+                    if (!genealogy->alive(neighbour))
+                        continue;
+                }
+                if (visited.insert(neighbour))
+                    queue.push_back(neighbour);
+            }
+        }
+
+        void advance() {
+            expand(queue[current]);
+            current++;
+        }
+
+        // Calls f with every node left to traverse.
+        template<class F>
+        void visit_nodes(F &f) {
+            for (; current < queue.size(); advance())
+                f(queue[current]);
+        }
+
+    public:
+        class iterator {
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using difference_type = std::ptrdiff_t;
+            using value_type = Virus;
+            using pointer = const value_type *;
+            using reference = const value_type &;
+
+        private:
+            Traversal *owner = nullptr;
+
+            bool at_end() const noexcept {
+                return owner->current == owner->queue.size();
+            }
+
+        public:
+            iterator() {};
+
+            explicit iterator(Traversal *o) : owner(o) {};
+
+            reference operator*() const {
+                return owner->genealogy->storage.virus(
+                        owner->queue[owner->current]);
+            }
+
+            pointer operator->() const {
+                return &operator*();
+            }
+
+            iterator &operator++() {
+                owner->advance();
+                return *this;
+            }
+
+            void operator++(int) {
+                operator++();
+            }
+
+            friend bool operator==(iterator const &it,
+                                   std::default_sentinel_t) {
+                return it.at_end();
+            }
+        };
+
+        iterator begin() {
+            return iterator(this);
+        }
+
+        std::default_sentinel_t end() const noexcept {
+            return {};
+        }
+
+        // Starts over from virus with given id.
+        template<class K>
+        void restart(K const &id) {
+            handle_t start = genealogy->find_any(id);
+            for (auto const &node: queue)
+                visited.erase(node);
+            queue.clear();
+            current = 0;
+            expand(start);
+        }
+    };
+
+    // Reachability index of the graph. Nodes are numbered in postorder of
+    // a depth-first spanning tree from the stem virus, and every node is
+    // labelled with sorted disjoint intervals of numbers covering itself
+    // and all its descendants: the range of its subtree, merged with
+    // labels of its other children. Checking if one virus descends from
+    // another is then a binary search in one label. Labels also keep
+    // depths and numbers of descendants.
+    //
+    // Creating viruses doesn't invalidate labels, since new viruses have
+    // no labelled descendants: queries about them walk up to the nearest
+    // labelled ancestors, remembering depths found on the way. Other
+    // changes which can change ancestors of labelled viruses mark the
+    // index for rebuilding by the next query; numbers of descendants are
+    // counted by walks after any change, and rebuilt once those walks add
+    // up to a rebuild. Building throws std::logic_error while reclaim() is
+    // pending.
+    class Reachability {
+    private:
+        friend class VirusGenealogy;
+
+        using interval = std::pair<std::uint32_t, std::uint32_t>;
+
+        struct label {
+            std::uint32_t number;
+            // Intervals of the node are intervals[first..last).
+            std::uint32_t first, last;
+            std::uint32_t descendants;
+            std::uint32_t min_depth, max_depth;
+        };
+
+        // Depths of a node created after the index was built.
+        struct fresh_node {
+            std::uint64_t born = 0;
+            std::uint32_t min_depth, max_depth;
+        };
+
+        VirusGenealogy const *genealogy;
+        // Values of changes and lineage_changes of the graph when the
+        // labels were built.
+        std::uint64_t version, lineage_version;
+        // Number of labelled nodes, and of nodes visited by walks counting
+        // descendants since the labels were built.
+        std::size_t size = 0, walked = 0;
+        typename storage_t::template node_map<label> labels;
+        std::vector<interval> intervals;
+        typename storage_t::template node_map<fresh_node> fresh;
+        // Reused by walks over new nodes, always left empty.
+        typename storage_t::visited_set seen;
+        std::vector<handle_t> queue;
+
+        explicit Reachability(VirusGenealogy const &g) : genealogy(&g) {
+            build();
+        }
+
+        // Non-recursive depth-first search. Children are always finished
+        // before their parents, since the graph has no cycles.
+        void build() {
+            genealogy->require_reclaimed();
+            auto const &storage = genealogy->storage;
+            using edge_iterator = decltype(storage.children(
+                    genealogy->stemNode).begin());
+            struct frame {
+                handle_t node;
+                edge_iterator next;
+                std::uint32_t low;
+            };
+
+            typename storage_t::template node_map<label> new_labels;
+            std::vector<interval> new_intervals, merged;
+            typename storage_t::visited_set visited;
+            std::vector<frame> stack;
+            std::vector<handle_t> order;
+            std::uint32_t number = 0;
+
+            auto enter = [&](handle_t const &node) {
+                stack.push_back({node, storage.children(node).begin(),
+                                 number});
+            };
 
-    // Guard used in remove() function when many deletes may happen at once.
-    class RemoveGuard {
-    private:
-        set_t *guarded_set;
-        typename set_t::iterator to_be_removed;
-        bool rollback;
+            visited.insert(genealogy->stemNode);
+            enter(genealogy->stemNode);
+            while (!stack.empty()) {
+                auto &top = stack.back();
+                if (top.next != storage.children(top.node).end()) {
+                    handle_t child = *top.next++;
+                    if (visited.insert(child))
+                        enter(child);
+                    continue;
+                }
 
-    public:
-        RemoveGuard(set_t *set, smart_ptr node)
-                : guarded_set(set), rollback(true) {
-            to_be_removed = guarded_set->find(node);
-        }
+                merged.clear();
+                merged.emplace_back(top.low, number);
+                for (auto const &child: storage.children(top.node)) {
+                    auto const &l = new_labels.at(child);
+                    merged.insert(merged.end(),
+                                  new_intervals.begin() + l.first,
+                                  new_intervals.begin() + l.last);
+                }
+                std::sort(merged.begin(), merged.end());
 
-        RemoveGuard(RemoveGuard const &) = delete;
+                auto first = std::uint32_t(new_intervals.size());
+                std::uint32_t count = 0;
+                for (auto const &[from, to]: merged) {
+                    if (new_intervals.size() > first &&
+                        from <= new_intervals.back().second + 1) {
+                        auto &last = new_intervals.back().second;
+                        count += std::max(last, to) - last;
+                        last = std::max(last, to);
+                    } else {
+                        count += to - from + 1;
+                        new_intervals.emplace_back(from, to);
+                    }
+                }
+                new_labels[top.node] = {number, first,
+                                        std::uint32_t(new_intervals.size()),
+                                        count - 1, 0, 0};
+                order.push_back(top.node);
+                number++;
+                stack.pop_back();
+            }
 
-        RemoveGuard &operator=(RemoveGuard const &) = delete;
+            // Parents come before children in reverse postorder.
+            for (auto it = order.rbegin(); it != order.rend(); ++it) {
+                auto &l = new_labels[*it];
+                bool first = true;
+                for (auto const &parent: storage.parents(*it)) {
+                    auto const &p = new_labels.at(parent);
+                    l.min_depth = first ? p.min_depth + 1
+                                        : std::min(l.min_depth, p.min_depth + 1);
+                    l.max_depth = std::max(l.max_depth, p.max_depth + 1);
+                    first = false;
+                }
+            }
 
-        // We can erase element when we know that everything went OK
-        // inside one remove() call.
-        ~RemoveGuard() noexcept {
-            if (!rollback)
-                guarded_set->erase(to_be_removed);
+            labels = std::move(new_labels);
+            intervals = std::move(new_intervals);
+            version = genealogy->changes;
+            lineage_version = genealogy->lineage_changes;
+            size = number;
+            walked = 0;
         }
 
-        void drop_rollback() noexcept {
-            rollback = false;
+        // Checks if the node existed when the labels were built.
+        bool labelled(handle_t const &node) const noexcept {
+            return genealogy->storage.meta(node).born <= version;
         }
-    };
 
-    // Subclass responsible for gathering all information about virus
-    // and its connections in virus graph.
-    class Node {
-    public:
-        Virus virus;
-        set_t parents, children;
+        bool reaches(label const &from, std::uint32_t to) const noexcept {
+            auto begin = intervals.begin() + from.first;
+            auto end = intervals.begin() + from.last;
+            auto it = std::upper_bound(
+                    begin, end, to, [](std::uint32_t n, interval const &i) {
+                        return n < i.first;
+                    });
+            return it != begin && std::prev(it)->second >= to;
+        }
 
-        explicit Node(virus_id_t id) : virus(id) {};
+        // Checks if the first node is the second one or its ancestor.
+        bool reaches(handle_t const &from, handle_t const &to) {
+            if (labelled(to))
+                return labelled(from) &&
+                       reaches(labels.at(from), labels.at(to).number);
 
-        virus_id_t get_id() {
-            return virus.get_id();
+            // New nodes have only new descendants, so search ancestors
+            // of the second node up to labelled ones.
+            auto const &storage = genealogy->storage;
+            auto forget = [&]() noexcept {
+                for (auto const &node: queue)
+                    seen.erase(node);
+                queue.clear();
+            };
+            bool found = false;
+            try {
+                queue.push_back(to);
+                seen.insert(to);
+                for (std::size_t i = 0; i < queue.size() && !found; i++) {
+                    if (queue[i] == from)
+                        found = true;
+                    else if (labelled(queue[i]))
+                        found = labelled(from) &&
+                                reaches(labels.at(from),
+                                        labels.at(queue[i]).number);
+                    else {
+                        for (auto const &parent: storage.parents(queue[i])) {
+                            queue.push_back(parent);
+                            if (!seen.insert(parent))
+                                queue.pop_back();
+                        }
+                    }
+                }
+            } catch (...) {
+                forget();
+                throw;
+            }
+            forget();
+            return found;
         }
 
-        // Basic bidirectional iterator implementation.
-        class Iterator {
-        public:
-            using iterator_category = std::bidirectional_iterator_tag;
-            using difference_type = std::ptrdiff_t;
-            using value_type = Virus;
-            using pointer = const value_type *;
-            using reference = const value_type &;
-
-        private:
-            typename set_t::iterator ptr;
+        // Returns depths of a node as a pair (shortest, longest).
+        std::pair<std::uint32_t, std::uint32_t> depths(handle_t const &node) {
+            if (labelled(node)) {
+                auto const &l = labels.at(node);
+                return {l.min_depth, l.max_depth};
+            }
 
-        public:
-            Iterator() {};
+            // Depths of new nodes are found in postorder of a depth-first
+            // search over their new ancestors.
+            auto const &storage = genealogy->storage;
+            auto known = [&](handle_t const &n) {
+                return labelled(n) ||
+                       fresh[n].born == storage.meta(n).born;
+            };
+            auto get = [&](handle_t const &n) {
+                if (labelled(n)) {
+                    auto const &l = labels.at(n);
+                    return std::pair(l.min_depth, l.max_depth);
+                }
+                auto const &f = fresh.at(n);
+                return std::pair(f.min_depth, f.max_depth);
+            };
 
-            explicit Iterator(typename set_t::iterator p) : ptr(p) {};
+            if (!known(node)) {
+                queue.clear();
+                queue.push_back(node);
+                while (!queue.empty()) {
+                    handle_t top = queue.back();
+                    bool ready = true;
+                    for (auto const &parent: storage.parents(top)) {
+                        if (!known(parent)) {
+                            queue.push_back(parent);
+                            ready = false;
+                        }
+                    }
+                    if (!ready)
+                        continue;
 
-            reference operator*() const {
-                return (*ptr)->virus;
+                    fresh_node f{storage.meta(top).born, 0, 0};
+                    bool first = true;
+                    for (auto const &parent: storage.parents(top)) {
+                        auto [low, high] = get(parent);
+                        f.min_depth = first ? low + 1
+                                            : std::min(f.min_depth, low + 1);
+                        f.max_depth = std::max(f.max_depth, high + 1);
+                        first = false;
+                    }
+                    fresh[top] = f;
+                    // The node could have been pushed more than once.
+                    while (!queue.empty() && known(queue.back()))
+                        queue.pop_back();
+                }
             }
+            return get(node);
+        }
 
-            pointer operator->() {
-                return &((*ptr)->virus);
-            }
+    public:
+        // Rebuilds the index if ancestors of some labelled virus could
+        // have changed since it was built.
+        void refresh() {
+            if (lineage_version != genealogy->lineage_changes)
+                build();
+        }
 
-            Iterator &operator++() {
-                ++ptr;
-                return *this;
-            }
+        // Returns length of the shortest path from the stem virus.
+        template<class K>
+        std::uint32_t min_depth(K const &id) {
+            refresh();
+            return depths(genealogy->find_any(id)).first;
+        }
 
-            Iterator operator++(int) {
-                Iterator res(*this);
-                operator++();
-                return res;
-            }
+        // Returns length of the longest path from the stem virus.
+        template<class K>
+        std::uint32_t max_depth(K const &id) {
+            refresh();
+            return depths(genealogy->find_any(id)).second;
+        }
 
-            Iterator &operator--() {
-                --ptr;
-                return *this;
-            }
+        // Returns number of descendants of given virus. After changes the
+        // descendants are counted by a walk down from the virus, until the
+        // walks since the last build visit as many viruses as the index
+        // labels; then the index is rebuilt instead.
+        template<class K>
+        std::size_t descendant_count(K const &id) {
+            handle_t node = genealogy->find_any(id);
+            if (version != genealogy->changes && walked >= size)
+                build();
+            if (version == genealogy->changes)
+                return labels.at(node).descendants;
 
-            Iterator operator--(int) {
-                Iterator res(*this);
-                operator--();
-                return res;
-            }
+            std::size_t count = 0;
+            auto counter = [&count](handle_t const &) noexcept { count++; };
+            descendants_range(*genealogy, node).visit_nodes(counter);
+            walked += count + 1;
+            return count;
+        }
 
-            friend bool operator==(Iterator const &a, Iterator const &b) {
-                return a.ptr == b.ptr;
-            }
+        // Checks if the first virus is an ancestor of the second one.
+        template<class A, class D>
+        bool is_ancestor(A const &ancestor_id, D const &id) {
+            refresh();
+            auto const &ancestor = genealogy->find_any(ancestor_id);
+            auto const &node = genealogy->find_any(id);
+            return ancestor != node && reaches(ancestor, node);
+        }
 
-            friend bool operator!=(Iterator const &a, Iterator const &b) {
-                return !(a == b);
-            }
-        };
+        // Returns ids of lowest common ancestors of two viruses: those
+        // common ancestors (a virus counts as its own ancestor here)
+        // which have no other common ancestor among their descendants.
+        template<class A, class B>
+        std::vector<virus_id_t> lowest_common_ancestors(A const &a_id,
+                                                        B const &b_id) {
+            refresh();
+            auto const &storage = genealogy->storage;
+            handle_t a = genealogy->find_any(a_id);
+            handle_t b = genealogy->find_any(b_id);
+            auto common = [&](handle_t const &node) {
+                return reaches(node, a) && reaches(node, b);
+            };
+
+            std::vector<virus_id_t> ids;
+            auto lowest = [&](handle_t const &node) {
+                if (!common(node))
+                    return;
+                for (auto const &child: storage.children(node)) {
+                    if (common(child))
+                        return;
+                }
+                ids.push_back(storage.virus(node).get_id());
+            };
 
-        Iterator begin() {
-            return Iterator(children.begin());
+            lowest(a);
+            ancestors_range(*genealogy, a).visit_nodes(lowest);
+            return ids;
         }
+    };
+
+    // Builds reachability index of the current graph.
+    Reachability reachability() const {
+        return Reachability(*this);
+    }
+
+    // Values computed for all viruses by topological_reduce(), valid until
+    // the genealogy changes.
+    template<class T>
+    class Reduction {
+    private:
+        friend class VirusGenealogy;
+
+        VirusGenealogy const *genealogy;
+        numbering numbers;
+        std::vector<std::optional<T>> values;
 
-        Iterator end() {
-            return Iterator(children.end());
+        explicit Reduction(VirusGenealogy const &g) : genealogy(&g) {}
+
+    public:
+        template<class K>
+        T const &operator[](K const &id) const {
+            return *values[numbers.at(genealogy->find_any(id))];
         }
     };
 
-    // Viruses are stored by map <id, smart pointer to virus>.
-    using virus_map = std::map<virus_id_t, smart_ptr>;
-    virus_map viruses;
-    smart_ptr stemNode;
+    // Calls f with every virus on given number of threads, by default one
+    // per hardware thread, each virus after all its parents. f is called
+    // from many threads at once. If f throws, the exception is rethrown
+    // once running calls finish, and the remaining viruses are skipped.
+    template<class F>
+    void for_each_node(F f, std::size_t threads = 0) const {
+        std::vector<handle_t> nodes;
+        numbering numbers;
+        number_nodes(nodes, numbers);
+        topological_walk<false>(
+                nodes, numbers,
+                [&](handle_t const &node, std::uint32_t) {
+                    f(storage.virus(node));
+                },
+                thread_count(threads));
+    }
 
-    // The connect() function that takes a vector as an argument.
-    // It gathers all changes (inserts to sets) and in case of exception
-    // it restores them to the beginning state.
-    void connect(virus_id_t const &child_id,
-                 std::vector<virus_id_t> const &parent_ids) {
-        std::vector<std::pair<set_t *, typename set_t::iterator> > in_process;
+    // Computes a value of type T for every virus, in parallel like
+    // for_each_node(): the value of a virus is f(virus, values), where
+    // values is a range of values of its parents.
+    template<class T, class F>
+    Reduction<T> topological_reduce(F f, std::size_t threads = 0) const {
+        return reduce<false, T>(std::move(f), threads);
+    }
+
+    // As topological_reduce(), but from the leaves up: values given to f
+    // are the values of children of the virus.
+    template<class T, class F>
+    Reduction<T> reverse_topological_reduce(F f,
+                                            std::size_t threads = 0) const {
+        return reduce<true, T>(std::move(f), threads);
+    }
+
+    using ancestors_range = Traversal<true>;
+    using descendants_range = Traversal<false>;
+
+    // Returns range of all ancestors of given virus.
+    ancestors_range ancestors(virus_id_t const &id) const {
+        return ancestors_range(*this, find_node(id));
+    }
+
+    template<class K> requires heterogeneous<K>
+    ancestors_range ancestors(K const &id) const {
+        return ancestors_range(*this, find_node(id));
+    }
+
+    // Returns range of all descendants of given virus.
+    descendants_range descendants(virus_id_t const &id) const {
+        return descendants_range(*this, find_node(id));
+    }
+
+    template<class K> requires heterogeneous<K>
+    descendants_range descendants(K const &id) const {
+        return descendants_range(*this, find_node(id));
+    }
+
+    // Calls f with every ancestor of given virus, nearest first.
+    template<class F>
+    void for_each_ancestor(virus_id_t const &id, F f) const {
+        for (auto const &virus: ancestors(id))
+            f(virus);
+    }
+
+    template<class K, class F> requires heterogeneous<K>
+    void for_each_ancestor(K const &id, F f) const {
+        for (auto const &virus: ancestors(id))
+            f(virus);
+    }
+
+    // Calls f with every descendant of given virus, nearest first.
+    template<class F>
+    void for_each_descendant(virus_id_t const &id, F f) const {
+        for (auto const &virus: descendants(id))
+            f(virus);
+    }
+
+    template<class K, class F> requires heterogeneous<K>
+    void for_each_descendant(K const &id, F f) const {
+        for (auto const &virus: descendants(id))
+            f(virus);
+    }
+
+    using snapshot_type = std::shared_ptr<VirusGenealogy const>;
+
+    // Returns read-only genealogy frozen in the current state. It shares
+    // all nodes and ids with this one, either of them copies only parts
+    // which it changes later. Snapshots can be read from other threads
+    // while this genealogy changes, provided its memory resource is
+    // thread-safe. Throws std::logic_error if reclaim() is pending.
+    snapshot_type snapshot() const
+    requires (storage_copy_on_write && index_copy_on_write) {
+        require_reclaimed();
+        return snapshot_type(new VirusGenealogy(*this, share_tag{}));
+    }
+
+    // Creates new genealogy with stem Virus. Nodes, edge lists and the id
+    // index are allocated from given memory resource, so e.g. an arena can
+    // be used to build the genealogy and free its memory at once.
+    explicit VirusGenealogy(virus_id_t const &stem_id,
+                            std::pmr::memory_resource *resource =
+                                    std::pmr::get_default_resource())
+            : accounts(std::allocate_shared<memory_accounts>(
+                    std::pmr::polymorphic_allocator<memory_accounts>(resource),
+                    resource)),
+              storage(&accounts->nodes, &accounts->edges),
+              viruses(&accounts->index) {
+        stemNode = storage.make_node(stem_id);
         try {
-            auto child = viruses.at(child_id);
-            for (auto &id: parent_ids) {
-                auto parent = viruses.at(id);
-                if (!parent->children.contains(child)) {
-                    auto it = parent->children.insert(child).first;
-                    try {
-                        in_process.push_back(
-                                std::make_pair(&parent->children, it));
-                    }
-                    catch (...) {
-                        parent->children.erase(it);
-                        throw;
-                    }
-                    child->parents.insert(parent);
-                }
-            }
-        } catch (const std::out_of_range &e) {
-            for (auto &[set, iter]: in_process)
-                set->erase(iter);
-            throw VirusNotFound();
+            storage.meta(stemNode).position =
+                    viruses.insert(stem_id, stemNode);
         } catch (...) {
-            for (auto &[set, iter]: in_process)
-                set->erase(iter);
+            storage.destroy_node(stemNode);
             throw;
         }
     }
 
-public:
-    using children_iterator = typename Node::Iterator;
-
-    // Creates new genealogy with stem Virus.
-    explicit VirusGenealogy(virus_id_t const &stem_id) {
-        stemNode = std::make_shared<Node>(stem_id);
-        viruses.emplace(std::make_pair(stem_id, stemNode));
+    // Creates new genealogy with stem Virus and viruses given by records,
+    // as if by bulk_create(records).
+    template<std::ranges::forward_range R>
+    VirusGenealogy(virus_id_t const &stem_id, R &&records,
+                   std::pmr::memory_resource *resource =
+                           std::pmr::get_default_resource())
+            : VirusGenealogy(stem_id, resource) {
+        bulk_create(std::forward<R>(records));
     }
 
     VirusGenealogy(const VirusGenealogy &) = delete;
 
     VirusGenealogy &operator=(const VirusGenealogy &) = delete;
 
-    virus_id_t get_stem_id() const {
-        return stemNode->get_id();
+    // Returns a reference if Virus::get_id() does.
+    decltype(auto) get_stem_id() const {
+        return storage.virus(stemNode).get_id();
     }
 
+    // Chunks of copy-on-write storages free their nodes themselves,
+    // possibly after the genealogy in case a snapshot still shares them.
     ~VirusGenealogy() noexcept {
-        for (auto it: viruses) {
-            it.second->children.clear();
-            it.second->parents.clear();
+        if constexpr (!storage_copy_on_write) {
+            viruses.for_each([this](auto const &, handle_t const &node) {
+                storage.destroy_node(node);
+            });
+            for (auto const &node: graveyard)
+                storage.destroy_node(node);
         }
-        viruses.clear();
     }
 
     // Returns iterator to the beginning of children list of given virus.
-    VirusGenealogy<Virus>::children_iterator
-    get_children_begin(virus_id_t const &id) const {
-        try {
-            return viruses.at(id)->begin();
-        } catch (const std::out_of_range &e) {
-            throw VirusNotFound();
-        }
+    children_iterator get_children_begin(virus_id_t const &id) const {
+        return storage.children_begin(find_node(id));
+    }
+
+    template<class K> requires heterogeneous<K>
+    children_iterator get_children_begin(K const &id) const {
+        return storage.children_begin(find_node(id));
     }
 
     // Returns iterator to the end of children list of given virus.
-    VirusGenealogy<Virus>::children_iterator
-    get_children_end(virus_id_t const &id) const {
-        try {
-            return viruses.at(id)->end();
-        } catch (const std::out_of_range &e) {
-            throw VirusNotFound();
-        }
+    children_iterator get_children_end(virus_id_t const &id) const {
+        return storage.children_end(find_node(id));
+    }
+
+    template<class K> requires heterogeneous<K>
+    children_iterator get_children_end(K const &id) const {
+        return storage.children_end(find_node(id));
     }
 
     // Returns ids of parents of given virus.
     std::vector<virus_id_t>
     get_parents(virus_id_t const &id) const {
-        std::vector<virus_id_t> parent_ids;
-        try {
-            for (auto parent: viruses.at(id)->parents)
-                parent_ids.push_back(parent->get_id());
-        } catch (const std::out_of_range &e) {
-            throw VirusNotFound();
-        }
+        return parent_ids(find_node(id));
+    }
+
+    template<class K> requires heterogeneous<K>
+    std::vector<virus_id_t> get_parents(K const &id) const {
+        return parent_ids(find_node(id));
+    }
+
+    // Returns iterator to the beginning of parents list of given virus.
+    // Unlike get_parents(), iterating parents copies nothing.
+    parents_iterator get_parents_begin(virus_id_t const &id) const {
+        return parents_begin(find_node(id));
+    }
+
+    template<class K> requires heterogeneous<K>
+    parents_iterator get_parents_begin(K const &id) const {
+        return parents_begin(find_node(id));
+    }
+
+    // Returns iterator to the end of parents list of given virus.
+    parents_iterator get_parents_end(virus_id_t const &id) const {
+        return parents_end(find_node(id));
+    }
+
+    template<class K> requires heterogeneous<K>
+    parents_iterator get_parents_end(K const &id) const {
+        return parents_end(find_node(id));
+    }
+
+    // Returns parents of given virus as a range of viruses.
+    parents_view get_parents_view(virus_id_t const &id) const {
+        auto const &node = find_node(id);
+        return {parents_begin(node), parents_end(node)};
+    }
+
+    template<class K> requires heterogeneous<K>
+    parents_view get_parents_view(K const &id) const {
+        auto const &node = find_node(id);
+        return {parents_begin(node), parents_end(node)};
+    }
+
+    // Returns number of parents of given virus.
+    std::size_t get_parents_count(virus_id_t const &id) const {
+        return parents_count(find_node(id));
+    }
 
-        return parent_ids;
+    template<class K> requires heterogeneous<K>
+    std::size_t get_parents_count(K const &id) const {
+        return parents_count(find_node(id));
     }
 
     // Checks if virus with given id exists.
     bool exists(virus_id_t const &id) const {
-        return viruses.contains(id);
+        return lookup(id) != nullptr;
+    }
+
+    template<class K> requires heterogeneous<K>
+    bool exists(K const &id) const {
+        return lookup(id) != nullptr;
     }
 
     // Returns reference to virus with given id.
     const Virus &operator[](virus_id_t const &id) const {
-        try {
-            return viruses.at(id)->virus;
-        } catch (const std::out_of_range &e) {
-            throw VirusNotFound();
-        }
+        return storage.virus(find_node(id));
+    }
+
+    template<class K> requires heterogeneous<K>
+    const Virus &operator[](K const &id) const {
+        return storage.virus(find_node(id));
     }
 
     // Adds new edge to genealogy graph.
     void connect(virus_id_t const &child_id,
                  virus_id_t const &parent_id) {
-        std::vector<virus_id_t> parent_ids{parent_id};
-        connect(child_id, parent_ids);
+        connect(child_id, std::span<virus_id_t const>(&parent_id, 1));
+    }
+
+    // Adds edges from all parents in a range of ids. Either all of them
+    // are added or, if one of the parents doesn't exist, none.
+    template<std::ranges::input_range R>
+    requires std::convertible_to<std::ranges::range_reference_t<R>,
+            virus_id_t const &>
+    void connect(virus_id_t const &child_id, R &&parent_ids) {
+        [[maybe_unused]] auto scope =
+                instruments.measure(GenealogyStats::connect);
+        lineage_changes++;
+        changes++;
+        link(find_node(child_id), std::forward<R>(parent_ids),
+             [this](virus_id_t const &id) -> auto const & {
+                 return find_node(id);
+             });
     }
 
     // Creates virus with new id with one parent.
@@ -276,89 +3895,509 @@ public:
         if (parent_ids.empty())
             return;
 
+        create_node(id, parent_ids, [this](auto const &key) -> auto const & {
+            return find_node(key);
+        });
+    }
+
+    // Same as create(), but the virus is constructed in place from the id
+    // and given extra arguments, e.g. its payload, which can be moved in.
+    // The id is copied only once, into the index.
+    template<class... Args>
+    requires std::constructible_from<Virus, virus_id_t const &, Args...>
+    void emplace(virus_id_t id, virus_id_t const &parent_id,
+                 Args &&... args) {
+        create_node(std::move(id), std::span<virus_id_t const>(&parent_id, 1),
+                    [this](auto const &key) -> auto const & {
+                        return find_node(key);
+                    }, std::forward<Args>(args)...);
+    }
+
+    template<class... Args>
+    requires std::constructible_from<Virus, virus_id_t const &, Args...>
+    void emplace(virus_id_t id, std::vector<virus_id_t> const &parent_ids,
+                 Args &&... args) {
+        if (parent_ids.empty())
+            return;
+
+        create_node(std::move(id), parent_ids,
+                    [this](auto const &key) -> auto const & {
+                        return find_node(key);
+                    }, std::forward<Args>(args)...);
+    }
+
+    // Reference to a virus which skips looking up its id. With dense
+    // storages it's a 32-bit index. Valid until the virus is removed;
+    // a handle of a removed virus may later refer to another one.
+    class node_handle {
+    private:
+        friend class VirusGenealogy;
+
+        handle_t node{};
+
+        explicit node_handle(handle_t const &h) : node(h) {}
+
+    public:
+        node_handle() = default;
+
+        friend bool operator==(node_handle const &,
+                               node_handle const &) = default;
+    };
+
+    // Returns handle of the virus with given id.
+    template<class K>
+    node_handle get_handle(K const &id) const {
+        return node_handle(find_any(id));
+    }
+
+    node_handle get_stem_handle() const {
+        return node_handle(stemNode);
+    }
+
+    Virus const &get_virus(node_handle const &h) const {
+        return storage.virus(h.node);
+    }
+
+    // Returns handles of parents or children of a virus as a view, valid
+    // until the genealogy changes. Parents removed by remove_deferred()
+    // are skipped.
+    auto get_parent_handles(node_handle const &h) const {
+        return storage.parents(h.node) |
+               std::views::filter([this](handle_t const &parent) {
+                   return alive(parent);
+               }) |
+               std::views::transform(to_handle);
+    }
+
+    auto get_child_handles(node_handle const &h) const {
+        return std::views::transform(storage.children(h.node), to_handle);
+    }
+
+    // Creates virus with new id with given parents and returns its handle.
+    // Throws std::invalid_argument if there are no parents.
+    node_handle create(virus_id_t const &id, node_handle const &parent) {
+        return create(id, std::span<node_handle const>(&parent, 1));
+    }
+
+    node_handle create(virus_id_t const &id,
+                       std::span<node_handle const> parents) {
+        if (parents.empty())
+            throw std::invalid_argument("no parents");
+
+        return node_handle(create_node(id, parents, from_handle));
+    }
+
+    // Same as create() with handles, constructing the virus in place.
+    template<class... Args>
+    requires std::constructible_from<Virus, virus_id_t const &, Args...>
+    node_handle emplace(virus_id_t id, node_handle const &parent,
+                        Args &&... args) {
+        return emplace(std::move(id), std::span<node_handle const>(&parent, 1),
+                       std::forward<Args>(args)...);
+    }
+
+    template<class... Args>
+    requires std::constructible_from<Virus, virus_id_t const &, Args...>
+    node_handle emplace(virus_id_t id, std::span<node_handle const> parents,
+                        Args &&... args) {
+        if (parents.empty())
+            throw std::invalid_argument("no parents");
+
+        return node_handle(create_node(std::move(id), parents, from_handle,
+                                       std::forward<Args>(args)...));
+    }
+
+    void connect(node_handle const &child, node_handle const &parent) {
+        connect(child, std::span<node_handle const>(&parent, 1));
+    }
+
+    template<std::ranges::input_range R>
+    requires std::same_as<std::remove_cvref_t<
+            std::ranges::range_reference_t<R>>, node_handle>
+    void connect(node_handle const &child, R &&parents) {
+        [[maybe_unused]] auto scope =
+                instruments.measure(GenealogyStats::connect);
+        lineage_changes++;
+        changes++;
+        link(child.node, std::forward<R>(parents), from_handle);
+    }
+
+    void remove(node_handle const &h) {
+        remove_node(h);
+    }
+
+private:
+    parents_iterator parents_begin(handle_t const &node) const {
+        auto const &parents = storage.parents(node);
+        return {this, parents.begin(), parents.end()};
+    }
+
+    parents_iterator parents_end(handle_t const &node) const {
+        auto const &parents = storage.parents(node);
+        return {this, parents.end(), parents.end()};
+    }
+
+    std::size_t parents_count(handle_t const &node) const {
+        if (graveyard.empty())
+            return storage.parents(node).size();
+        return std::size_t(std::distance(parents_begin(node),
+                                         parents_end(node)));
+    }
+
+    static constexpr auto to_handle = [](handle_t const &node) {
+        return node_handle(node);
+    };
+    static constexpr auto from_handle =
+            [](node_handle const &h) -> handle_t const & {
+        return h.node;
+    };
+
+    // The virus is constructed from the id and extra arguments, the id
+    // is then moved into the index.
+    template<class R, class F, class... Args>
+    handle_t create_node(virus_id_t id, R const &parent_keys,
+                         F node_of, Args &&... args) {
+        [[maybe_unused]] auto scope =
+                instruments.measure(GenealogyStats::create);
+        // A virus which was removed with its id still in the index only
+        // gives the id up, the rest is left for reclaim().
+        if (!graveyard.empty()) {
+            auto found = viruses.find(id);
+            if (found != nullptr && !alive(*found)) {
+                handle_t dead = *found;
+                detach(dead);
+            }
+        }
         if (exists(id))
             throw VirusAlreadyCreated();
 
-        auto it = viruses.insert({id, std::make_shared<Node>(id)}).first;
+        changes++;
+        auto node = storage.make_node(std::as_const(id),
+                                      std::forward<Args>(args)...);
+        storage.meta(node).born = changes;
+        typename index_t::position pos;
+        try {
+            pos = viruses.insert(std::move(id), node);
+        } catch (...) {
+            storage.destroy_node(node);
+            throw;
+        }
+        storage.meta(node).position = pos;
+
+        try {
+            storage.reserve_parents(node, std::ranges::size(parent_keys));
+            link(node, parent_keys, node_of);
+        } catch (...) {
+            viruses.erase(pos);
+            storage.destroy_node(node);
+            throw;
+        }
+        return node;
+    }
+
+public:
+
+    // Creates many viruses at once from a range of (id, parent ids) records,
+    // e.g. std::pair<virus_id_t, std::vector<virus_id_t>>. Every parent has
+    // to exist already or be created by an earlier record. Records with no
+    // parents are skipped as in create(). Storage is sized once for all
+    // records and edges are added in bulk; if an exception is thrown
+    // the genealogy is left unchanged.
+    template<std::ranges::forward_range R>
+    void bulk_create(R &&records) {
+        [[maybe_unused]] auto scope =
+                instruments.measure(GenealogyStats::bulk_create);
+        reclaim();
+        changes++;
+        std::vector<handle_t> nodes;
+        std::vector<typename index_t::position> positions;
+        // Parents of nodes[i] are parents[offsets[i]..offsets[i + 1]).
+        std::vector<std::size_t> offsets{0};
+        std::vector<handle_t> parents;
+
+        // Reserving the index also keeps positions valid until the end.
+        auto count = static_cast<std::size_t>(std::ranges::distance(records));
+        nodes.reserve(count);
+        positions.reserve(count);
+        offsets.reserve(count + 1);
+        storage.reserve(count);
+        viruses.reserve(viruses.size() + count);
 
         try {
-            connect(id, parent_ids);
+            for (auto const &record: records) {
+                auto const &[id, parent_ids] = record;
+                std::size_t first = parents.size();
+                for (auto const &parent_id: parent_ids)
+                    parents.push_back(find_any(parent_id));
+                if (parents.size() == first)
+                    continue;
+
+                auto own = parents.begin() + first;
+                std::sort(own, parents.end());
+                parents.erase(std::unique(own, parents.end()), parents.end());
+
+                virus_id_t const &child_id = id;
+                if (exists(child_id))
+                    throw VirusAlreadyCreated();
+
+                auto node = storage.make_node(child_id);
+                try {
+                    storage.meta(node).position =
+                            viruses.insert(child_id, node);
+                    storage.meta(node).born = changes;
+                    positions.push_back(storage.meta(node).position);
+                } catch (...) {
+                    storage.destroy_node(node);
+                    throw;
+                }
+                nodes.push_back(node);
+                offsets.push_back(parents.size());
+            }
+
+            storage.add_edges(nodes, offsets, parents);
+            instruments.added_edges(parents.size());
         } catch (...) {
-            viruses.erase(it);
+            for (std::size_t i = 0; i < nodes.size(); ++i) {
+                viruses.erase(positions[i]);
+                storage.destroy_node(nodes[i]);
+            }
             throw;
         }
     }
 
+    // Makes room for given total numbers of viruses and edges, so that
+    // building the genealogy up to them doesn't grow the index step by
+    // step. Until then dense storages also give every edge array the
+    // average number of edges per virus, if above two, when its first
+    // edge is added. Node-based
+    // containers (SharedNodeStorage and MapIndex) can't be preallocated.
+    void reserve(std::size_t nodes, std::size_t edges = 0) {
+        auto size = viruses.size();
+        // An edge array of one or two edges grows to it quickly anyway.
+        std::size_t per_node = nodes > 0 ? edges / nodes : 0;
+        storage.reserve(nodes > size ? nodes - size : 0,
+                        per_node > 2 ? per_node : 0);
+        viruses.reserve(nodes);
+    }
+
+    // Makes room for given total number of parents or children of a virus,
+    // given by id or handle.
+    template<class K>
+    void reserve_parents(K const &key, std::size_t n) {
+        storage.reserve_parents(find_key(key), n);
+    }
+
+    template<class K>
+    void reserve_children(K const &key, std::size_t n) {
+        storage.reserve_children(find_key(key), n);
+    }
+
     // Remove virus with given id from graph. Takes care about case when
     // deleting one virus cause deletion of other viruses.
     void remove(virus_id_t const &id) {
-        if (id == get_stem_id())
-            throw TriedToRemoveStemVirus();
+        remove_node(id);
+    }
 
-        smart_ptr begin_node;
-        try {
-            begin_node = viruses.at(id);
-        }
-        catch (const std::out_of_range &e) {
-            throw VirusNotFound();
-        }
+    template<class K> requires heterogeneous<K>
+    void remove(K const &id) {
+        remove_node(id);
+    }
+
+    // Removes virus like remove(), using given number of threads, by
+    // default one per hardware thread, for large cascades. Edge lists are
+    // changed by many threads at once, so the memory resource of
+    // the genealogy has to be thread-safe.
+    void parallel_remove(virus_id_t const &id, std::size_t threads = 0) {
+        parallel_remove_node(id, threads);
+    }
 
-        // Set of nodes which should be removed from graph.
-        std::set<smart_ptr> fully_remove;
-        std::vector<typename virus_map::iterator> remove_iterators;
+    template<class K> requires heterogeneous<K>
+    void parallel_remove(K const &id, std::size_t threads = 0) {
+        parallel_remove_node(id, threads);
+    }
 
-        // For each node count number of his parents which were deleted.
-        std::map<virus_id_t, size_t> removed_parents;
+    // Removes virus like remove(), in time proportional to its number of
+    // parents. The virus and viruses left only with removed ancestors are
+    // no longer found by id at once, and parent views and traversals of
+    // ancestors skip them, but their edges and nodes are torn down later
+    // by reclaim(). Until then whole-graph operations (for_each_node(),
+    // reductions, reachability indices, snapshots, save()) throw
+    // std::logic_error; compact(), bulk_create() and batches call reclaim()
+    // themselves. Lookups while removals are pending search upwards for
+    // the stem once per virus after every deferred removal.
+    template<class K>
+    void remove_deferred(K const &id) {
+        [[maybe_unused]] auto scope =
+                instruments.measure(GenealogyStats::remove);
+        handle_t node = find_key(id);
+        if (node == stemNode)
+            throw TriedToRemoveStemVirus();
 
-        // Queue used in bfs-like graph traverse.
-        std::queue<smart_ptr> to_process;
+        detach(node);
+        changes++;
+        lineage_changes++;
+        removals++;
+    }
 
-        to_process.push(begin_node);
-        while (!to_process.empty()) {
-            auto &current = to_process.front();
-            to_process.pop();
-            fully_remove.insert(current);
-            remove_iterators.push_back(viruses.find(current->get_id()));
-            for (auto child: current->children) {
-                auto &val = removed_parents[child->get_id()];
-                val++;
-                // If all parents were already deleted child should be deleted.
-                if (val == child->parents.size())
-                    to_process.push(child);
+    // Tears down at most about budget edges and nodes removed by
+    // remove_deferred() and returns whether some are still left.
+    bool reclaim(std::size_t budget =
+                         std::numeric_limits<std::size_t>::max()) {
+        std::size_t edges = 0, nodes = 0;
+        while (!graveyard.empty() && budget > 0) {
+            budget--;
+            handle_t node = graveyard.back();
+            auto const &children = storage.children(node);
+            if (children.empty()) {
+                if constexpr (storage_copy_on_write)
+                    storage.make_writable(node);
+                graveyard.pop_back();
+                storage.destroy_node(node);
+                nodes++;
+                continue;
             }
+
+            handle_t child = *std::prev(children.end());
+            bool orphan = storage.parents(child).size() == 1;
+            make_room(graveyard, 1);
+            if constexpr (storage_copy_on_write) {
+                storage.make_writable(node);
+                storage.make_writable(child);
+            }
+            if constexpr (index_copy_on_write) {
+                if (orphan)
+                    viruses.make_writable(storage.meta(child).position);
+            }
+
+            // No exceptions can occur from now.
+            storage.unlink_last_child(node);
+            storage.unlink_parent(child, node);
+            edges++;
+            if (orphan)
+                bury(child);
         }
+        instruments.removed_edges(edges);
+        instruments.removed_nodes(nodes);
+        return !graveyard.empty();
+    }
+
+    // Whether reclaim() has some work left.
+    bool reclaim_pending() const noexcept {
+        return !graveyard.empty();
+    }
 
-        // Remove guards used to safely erase deleted nodes from parents sets
-        // of nodes which stay in graph.
-        std::vector<std::unique_ptr<RemoveGuard>> remove_edge;
-        for (auto &current: fully_remove) {
-            for (auto &child: current->children) {
-                if (fully_remove.find(child) == fully_remove.end()) {
-                    remove_edge.push_back(std::make_unique<RemoveGuard>
-                                                  (&(child->parents), current));
+    // Lays the genealogy out again after many removals. Nodes are
+    // recreated in breadth-first order from the stem, which gives dense
+    // storages consecutive indices, edge lists are allocated at their
+    // exact sizes, and the index is rebuilt without holes. Memory of
+    // the old layout goes back to the memory resource, except chunks still
+    // shared with snapshots. Children may come in another order afterwards.
+    // Invalidates all handles, iterators and references. If an exception
+    // is thrown the genealogy is left unchanged.
+    void compact()
+    requires (relocate_viruses || std::is_copy_constructible_v<Virus>) {
+        reclaim();
+        std::vector<handle_t> order{stemNode};
+        order.reserve(viruses.size());
+        {
+            typename storage_t::visited_set visited;
+            visited.insert(stemNode);
+            for (std::size_t i = 0; i < order.size(); ++i) {
+                handle_t node = order[i];
+                for (auto const &child: storage.children(node)) {
+                    if (visited.insert(child))
+                        order.push_back(child);
                 }
             }
         }
+        numbering numbers;
+        for (std::size_t i = 0; i < order.size(); ++i)
+            numbers[order[i]] = std::uint32_t(i);
 
-        for (auto &parent: begin_node->parents) {
-            remove_edge.push_back(std::make_unique<RemoveGuard>
-                                          (&(parent->children), begin_node));
-        }
+        VirusGenealogy rebuilt(*this, empty_tag{});
+        rebuilt.storage.reserve(order.size());
+        rebuilt.viruses.reserve(order.size());
+        std::vector<handle_t> nodes;
+        nodes.reserve(order.size());
 
-        // No exceptions can occur from now.
-        for (auto &remove_guard: remove_edge)
-            remove_guard->drop_rollback();
-        remove_edge.clear();
+        // Moves already relocated viruses back.
+        auto restore = [&]() noexcept {
+            if constexpr (relocate_viruses) {
+                for (std::size_t i = 0; i < nodes.size(); ++i) {
+                    storage.virus(order[i]) =
+                            std::move(rebuilt.storage.virus(nodes[i]));
+                }
+            }
+        };
+
+        try {
+            for (auto const &old: order) {
+                handle_t node;
+                if constexpr (relocate_viruses)
+                    node = rebuilt.storage.make_node(
+                            std::move(storage.virus(old)));
+                else
+                    node = rebuilt.storage.make_node(storage.virus(old));
+                try {
+                    rebuilt.storage.meta(node).position =
+                            rebuilt.viruses.insert(
+                                    rebuilt.storage.virus(node).get_id(),
+                                    node);
+                } catch (...) {
+                    if constexpr (relocate_viruses)
+                        storage.virus(old) =
+                                std::move(rebuilt.storage.virus(node));
+                    rebuilt.storage.destroy_node(node);
+                    throw;
+                }
+                nodes.push_back(node);
+            }
 
-        for (auto &it: fully_remove) {
-            it->parents.clear();
-            it->children.clear();
+            // Parents of nodes[i] are parents[offsets[i]..offsets[i + 1]).
+            std::vector<std::size_t> offsets{0};
+            std::vector<handle_t> parents;
+            offsets.reserve(order.size() + 1);
+            for (auto const &old: order) {
+                for (auto const &parent: storage.parents(old))
+                    parents.push_back(nodes[numbers.at(parent)]);
+                offsets.push_back(parents.size());
+            }
+            rebuilt.storage.add_edges(nodes, offsets, parents);
+        } catch (...) {
+            restore();
+            throw;
         }
 
-        for (auto &iter: remove_iterators)
-            viruses.erase(iter);
+        // No exceptions can occur from now. The old layout goes away
+        // with rebuilt.
+        storage.swap(rebuilt.storage);
+        viruses.swap(rebuilt.viruses);
+        rebuilt.stemNode = stemNode;
+        stemNode = nodes[0];
+        changes++;
+        lineage_changes++;
+        for (auto const &node: nodes)
+            storage.meta(node).born = changes;
+    }
+
+    // Returns counters of operations so far. Available with
+    // CountingInstrumentation; safe to call while other threads read or
+    // change the genealogy.
+    GenealogyStats stats() const requires instrumented {
+        return instruments.stats();
+    }
+
+    void reset_stats() requires instrumented {
+        instruments.reset();
     }
 
+    // Returns memory currently allocated by parts of the genealogy, kept up
+    // to date on every allocation. A snapshot reports the same numbers as
+    // its genealogy, including chunks kept only by snapshots.
+    GenealogyMemoryUsage memory_usage() const noexcept {
+        return {accounts->index.bytes(), accounts->nodes.bytes(),
+                accounts->edges.bytes()};
+    }
 };
 
 #endif //VIRUS_GENEALOGY_H
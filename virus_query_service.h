@@ -0,0 +1,274 @@
+#ifndef VIRUS_QUERY_SERVICE_H
+#define VIRUS_QUERY_SERVICE_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <future>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "virus_genealogy.h"
+
+// Asynchronous queries over a shared genealogy, answered by a pool of
+// worker threads. A worker takes up to max_batch queued queries at once
+// and answers all of them against a single snapshot, or under a single
+// shared lock if the genealogy has no snapshots. Each kind of query gets
+// a share of every batch. If taking the snapshot or the lock fails, the
+// futures of the whole batch get the exception. A query equal to one
+// which is still queued or being answered gets the same future instead
+// of being answered again.
+//
+// Source is ConcurrentVirusGenealogy or DurableVirusGenealogy, or any
+// other type whose snapshot() or read(f) may be called from other
+// threads. It has to outlive the service. Ids have to be ordered.
+template<class Source>
+class VirusQueryService {
+public:
+    using virus_id_t = std::remove_cvref_t<
+            decltype(std::declval<Source const &>().get_stem_id())>;
+
+private:
+    // Futures of queries which aren't answered yet, and ids of the ones
+    // which no worker took yet, oldest first.
+    template<class R>
+    struct queue {
+        struct flight {
+            std::promise<R> promise;
+            std::shared_future<R> future;
+        };
+
+        std::map<virus_id_t, flight> in_flight;
+        std::deque<virus_id_t> queued;
+    };
+
+    // Queries taken by a worker, kept to reuse their memory, and the
+    // number of them answered so far, in the order of the lists.
+    struct batch {
+        std::vector<virus_id_t> exists, parents, ancestors;
+        std::size_t answered = 0;
+
+        void clear() noexcept {
+            exists.clear();
+            parents.clear();
+            ancestors.clear();
+            answered = 0;
+        }
+    };
+
+    Source &source;
+    std::size_t max_batch;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    // Guarded by mutex.
+    queue<bool> exists_queue;
+    queue<std::vector<virus_id_t>> parents_queue, ancestors_queue;
+    std::size_t queued = 0;
+    bool stop = false;
+
+    std::vector<std::jthread> workers;
+
+    template<class R>
+    std::shared_future<R> submit(queue<R> &q, virus_id_t const &id) {
+        std::lock_guard lock(mutex);
+        auto [it, fresh] = q.in_flight.try_emplace(id);
+        if (fresh) {
+            try {
+                it->second.future = it->second.promise.get_future().share();
+                q.queued.push_back(id);
+            } catch (...) {
+                q.in_flight.erase(it);
+                throw;
+            }
+            queued++;
+            changed.notify_one();
+        }
+        return it->second.future;
+    }
+
+    // Guarded by mutex. Takes up to limit oldest queries, within budget.
+    template<class R>
+    void take(queue<R> &q, std::vector<virus_id_t> &ids, std::size_t limit,
+              std::size_t &budget) {
+        auto n = std::min({limit, budget, q.queued.size()});
+        std::move(q.queued.begin(), q.queued.begin() + std::ptrdiff_t(n),
+                  std::back_inserter(ids));
+        q.queued.erase(q.queued.begin(), q.queued.begin() + std::ptrdiff_t(n));
+        budget -= n;
+        queued -= n;
+    }
+
+    // Takes the promise of a query out, so later equal queries see later
+    // changes.
+    template<class R>
+    std::promise<R> settle(queue<R> &q, virus_id_t const &id) {
+        std::lock_guard lock(mutex);
+        auto it = q.in_flight.find(id);
+        auto promise = std::move(it->second.promise);
+        q.in_flight.erase(it);
+        return promise;
+    }
+
+    // Answers a query as soon as it's computed.
+    template<class R, class F>
+    void finish(queue<R> &q, virus_id_t const &id, F compute) {
+        std::optional<R> result;
+        std::exception_ptr error;
+        try {
+            result.emplace(compute());
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        auto promise = settle(q, id);
+        if (error)
+            promise.set_exception(error);
+        else
+            promise.set_value(std::move(*result));
+    }
+
+    // Gives the error to all queries of the batch which aren't answered.
+    void fail(batch const &b, std::exception_ptr error) {
+        auto skip = b.answered;
+        auto fail_all = [&](auto &q, std::vector<virus_id_t> const &ids) {
+            for (auto const &id: ids) {
+                if (skip > 0)
+                    skip--;
+                else
+                    settle(q, id).set_exception(error);
+            }
+        };
+        fail_all(exists_queue, b.exists);
+        fail_all(parents_queue, b.parents);
+        fail_all(ancestors_queue, b.ancestors);
+    }
+
+    template<class G>
+    void answer(G const &genealogy, batch &b) {
+        for (auto const &id: b.exists) {
+            finish(exists_queue, id, [&] {
+                return genealogy.exists(id);
+            });
+            b.answered++;
+        }
+        for (auto const &id: b.parents) {
+            finish(parents_queue, id, [&] {
+                return genealogy.get_parents(id);
+            });
+            b.answered++;
+        }
+
+        // One traversal is restarted for all ancestor queries, so its
+        // queue and visited set are allocated once per batch.
+        std::optional<typename G::ancestors_range> range;
+        for (auto const &id: b.ancestors) {
+            finish(ancestors_queue, id, [&] {
+                if (range)
+                    range->restart(id);
+                else
+                    range.emplace(genealogy.ancestors(id));
+                std::vector<virus_id_t> ids;
+                for (auto const &virus: *range)
+                    ids.push_back(virus.get_id());
+                return ids;
+            });
+            b.answered++;
+        }
+    }
+
+    void work() {
+        batch b;
+        while (true) {
+            {
+                std::unique_lock lock(mutex);
+                changed.wait(lock, [&] { return stop || queued > 0; });
+                // Queries still queued when stopping are answered first.
+                if (queued == 0)
+                    return;
+                // Every kind of query gets its share of the batch first,
+                // so a stream of one kind doesn't hold the others back.
+                b.clear();
+                std::size_t budget = max_batch;
+                for (auto limit: {(max_batch + 2) / 3, max_batch}) {
+                    take(exists_queue, b.exists, limit, budget);
+                    take(parents_queue, b.parents, limit, budget);
+                    take(ancestors_queue, b.ancestors, limit, budget);
+                }
+                if (queued > 0)
+                    changed.notify_one();
+            }
+
+            try {
+                if constexpr (requires { source.snapshot(); }) {
+                    auto snapshot = source.snapshot();
+                    answer(*snapshot, b);
+                } else {
+                    source.read([&](auto const &genealogy) {
+                        answer(genealogy, b);
+                    });
+                }
+            } catch (...) {
+                fail(b, std::current_exception());
+            }
+        }
+    }
+
+public:
+    // Starts given number of workers, by default one per hardware thread.
+    explicit VirusQueryService(Source &genealogy, std::size_t threads = 0,
+                               std::size_t batch_size = 256)
+            : source(genealogy), max_batch(std::max<std::size_t>(
+                    batch_size, 1)) {
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        try {
+            workers.reserve(threads);
+            for (std::size_t t = 0; t < threads; t++)
+                workers.emplace_back([this] { work(); });
+        } catch (...) {
+            if (workers.empty())
+                throw;
+        }
+    }
+
+    VirusQueryService(VirusQueryService const &) = delete;
+
+    VirusQueryService &operator=(VirusQueryService const &) = delete;
+
+    // Answers all queued queries, then stops the workers.
+    ~VirusQueryService() {
+        {
+            std::lock_guard lock(mutex);
+            stop = true;
+            changed.notify_all();
+        }
+        workers.clear();
+    }
+
+    std::shared_future<bool> exists(virus_id_t const &id) {
+        return submit(exists_queue, id);
+    }
+
+    // The futures throw VirusNotFound if there is no virus with given id.
+    std::shared_future<std::vector<virus_id_t>>
+    get_parents(virus_id_t const &id) {
+        return submit(parents_queue, id);
+    }
+
+    // Ids of all ancestors of the virus, nearest first.
+    std::shared_future<std::vector<virus_id_t>>
+    get_ancestors(virus_id_t const &id) {
+        return submit(ancestors_queue, id);
+    }
+};
+
+#endif //VIRUS_QUERY_SERVICE_H